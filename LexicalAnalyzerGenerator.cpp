@@ -1,6 +1,80 @@
 #include "LexicalAnalyzerGenerator.h"
 #include <sstream>
 #include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <filesystem>
+#include <memory>
+#include <unordered_map>
+#include <chrono>
+#include <iterator>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <random>
+#include <limits>
+#include <dlfcn.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace {
+
+// Heap estimates for memory accounting, after the 64-bit libstdc++ layout:
+// a red-black tree node is 32 bytes of links and colour followed by its value
+const size_t TREE_NODE_OVERHEAD = 32;
+
+size_t roundToWord(size_t bytes) {
+    return (bytes + 7) & ~static_cast<size_t>(7);
+}
+
+template <typename Value>
+size_t treeBytes(size_t count) {
+    return count * (TREE_NODE_OVERHEAD + roundToWord(sizeof(Value)));
+}
+
+// Heap buffer of a string beyond the small-string storage
+size_t stringBytes(const string& text) {
+    return text.capacity() > 15 ? text.capacity() + 1 : 0;
+}
+
+size_t stateSetBytes(const set<int>& states) {
+    return treeBytes<int>(states.size());
+}
+
+} // namespace
+
+// ==================== Path Helpers ====================
+
+string withoutExtension(const string& path) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    bool hasExtension = dot != string::npos && (slash == string::npos || dot > slash);
+    return hasExtension ? path.substr(0, dot) : path;
+}
+
+string defaultOutputFile(const string& specFile) {
+    return withoutExtension(specFile) + ".cpp";
+}
+
+// ==================== Argument Helpers ====================
+
+bool parsePositiveOption(const string& text, size_t& value) {
+    if (text.empty() || text.size() > 18 || !all_of(text.begin(), text.end(), [](char c) {
+            return isdigit(static_cast<unsigned char>(c)) != 0;
+        })) {
+        return false;
+    }
+    value = static_cast<size_t>(stoull(text));
+    return value > 0;
+}
 
 // ==================== NFA Implementation ====================
 
@@ -140,8 +214,52 @@ NFA NFA::kleeneStar(const NFA& nfa) {
     return result;
 }
 
+NFA NFA::unionAll(const vector<NFA>& nfas) {
+    NFA result;
+    int newStart = 0;
+    int offset = 1;
+    
+    // Add new start state
+    result.addState(newStart);
+    result.setStartState(newStart);
+    
+    for (const auto& nfa : nfas) {
+        // An empty NFA has no start state to connect to
+        if (nfa.states.empty()) continue;
+        
+        // Add states from nfa with offset, keeping its accepting states
+        for (const auto& state : nfa.states) {
+            result.addState(state.id + offset, state.isAccepting);
+        }
+        
+        // Connect new start to nfa with epsilon
+        result.addTransition(newStart, nfa.startState + offset, '\0');
+        
+        // Add transitions from nfa with offset
+        for (const auto& trans : nfa.transitions) {
+            result.addTransition(trans.fromState + offset, trans.toState + offset, trans.symbol);
+        }
+        
+        // Keep rule tags of the accepting states
+        for (const auto& tag : nfa.acceptRules) {
+            result.acceptRules[tag.first + offset] = tag.second;
+        }
+        
+        offset += nfa.states.size();
+    }
+    
+    result.stateCounter = offset;
+    
+    return result;
+}
+
 NFA NFA::fromRegex(const string& regex) {
-    string postfix = RegexParser::infixToPostfix(regex);
+    string postfix;
+    {
+        TraceScope trace("build", "parse regex", regex);
+        postfix = RegexParser::infixToPostfix(regex);
+    }
+    TraceScope trace("build", "Thompson NFA", regex);
     stack<NFA> nfaStack;
     
     for (char c : postfix) {
@@ -198,6 +316,12 @@ void NFA::addAcceptingState(int stateId) {
     }
 }
 
+void NFA::setAcceptRule(int ruleIndex) {
+    for (int acceptState : acceptingStates) {
+        acceptRules[acceptState] = ruleIndex;
+    }
+}
+
 set<int> NFA::epsilonClosure(int state) const {
     set<int> closure;
     stack<int> stateStack;
@@ -247,6 +371,14 @@ set<int> NFA::move(const set<int>& states, char symbol) const {
     return result;
 }
 
+size_t NFA::memoryBytes() const {
+    size_t bytes = states.capacity() * sizeof(State) + transitions.capacity() * sizeof(Transition);
+    for (const auto& state : states) {
+        bytes += stringBytes(state.tokenType);
+    }
+    return bytes + treeBytes<int>(acceptingStates.size()) + treeBytes<pair<const int, int>>(acceptRules.size());
+}
+
 void NFA::display() const {
     cout << "\n========== NFA Structure ==========" << endl;
     cout << "Start State: " << startState << endl;
@@ -269,11 +401,533 @@ void NFA::display() const {
     cout << "===================================" << endl;
 }
 
+// ==================== Subset Construction Helpers ====================
+
+namespace {
+
+// Subset construction work done by one thread; kept local and summed once
+struct SubsetCounts {
+    uint64_t closureCalls;
+    uint64_t moveCalls;
+    
+    SubsetCounts() : closureCalls(0), moveCalls(0) {}
+    
+    SubsetCounts& operator+=(const SubsetCounts& other) {
+        closureCalls += other.closureCalls;
+        moveCalls += other.moveCalls;
+        return *this;
+    }
+    
+    void addTo(BuildStats* stats) const {
+        if (stats) {
+            stats->closureCalls += closureCalls;
+            stats->moveCalls += moveCalls;
+        }
+    }
+};
+
+/**
+ * @brief Outgoing-edge index of an NFA, grouped per source state
+ */
+class NFAAdjacency {
+private:
+    vector<vector<int>> epsilonEdges;               // state -> epsilon targets
+    vector<vector<pair<char, int>>> symbolEdges;    // state -> (symbol, target)
+    
+public:
+    explicit NFAAdjacency(const NFA& nfa) {
+        int stateCount = 0;
+        for (const auto& state : nfa.getStates()) {
+            stateCount = max(stateCount, state.id + 1);
+        }
+        for (const auto& trans : nfa.getTransitions()) {
+            stateCount = max(stateCount, max(trans.fromState, trans.toState) + 1);
+        }
+        stateCount = max(stateCount, nfa.getStartState() + 1);
+        
+        epsilonEdges.resize(stateCount);
+        symbolEdges.resize(stateCount);
+        for (const auto& trans : nfa.getTransitions()) {
+            if (trans.symbol == '\0') {
+                epsilonEdges[trans.fromState].push_back(trans.toState);
+            } else {
+                symbolEdges[trans.fromState].push_back({trans.symbol, trans.toState});
+            }
+        }
+    }
+    
+    // Epsilon closure of a set of seed states
+    set<int> closure(const set<int>& seeds, SubsetCounts& counts) const {
+        counts.closureCalls++;
+        set<int> result(seeds);
+        vector<int> stateStack(seeds.begin(), seeds.end());
+        
+        while (!stateStack.empty()) {
+            int current = stateStack.back();
+            stateStack.pop_back();
+            
+            for (int target : epsilonEdges[current]) {
+                if (result.insert(target).second) {
+                    stateStack.push_back(target);
+                }
+            }
+        }
+        
+        return result;
+    }
+    
+    // Closed successor sets of a DFA state, in alphabet order, non-empty only
+    vector<pair<char, set<int>>> successors(const set<int>& states, SubsetCounts& counts) const {
+        vector<int> buckets[256];
+        vector<char> touched;
+        
+        for (int state : states) {
+            for (const auto& edge : symbolEdges[state]) {
+                vector<int>& bucket = buckets[static_cast<unsigned char>(edge.first)];
+                if (bucket.empty()) {
+                    touched.push_back(edge.first);
+                }
+                bucket.push_back(edge.second);
+            }
+        }
+        
+        // Same order as iterating a set<char> alphabet
+        sort(touched.begin(), touched.end());
+        counts.moveCalls += touched.size();
+        
+        vector<pair<char, set<int>>> result;
+        result.reserve(touched.size());
+        for (char symbol : touched) {
+            const vector<int>& bucket = buckets[static_cast<unsigned char>(symbol)];
+            result.push_back({symbol, closure(set<int>(bucket.begin(), bucket.end()), counts)});
+        }
+        
+        return result;
+    }
+};
+
+/**
+ * @brief Mark a new DFA state accepting if its NFA set contains an accepting
+ * state, tagging it with the highest-priority (lowest index) rule
+ */
+void classifyState(DFA& dfa, int dfaState, const set<int>& nfaStates, const NFA& nfa) {
+    const set<int>& nfaAccepting = nfa.getAcceptingStates();
+    const map<int, int>& acceptRules = nfa.getAcceptRules();
+    bool accepting = false;
+    int rule = -1;
+    
+    for (int nfaState : nfaStates) {
+        if (!nfaAccepting.count(nfaState)) continue;
+        accepting = true;
+        auto tag = acceptRules.find(nfaState);
+        if (tag != acceptRules.end() && (rule == -1 || tag->second < rule)) {
+            rule = tag->second;
+        }
+    }
+    
+    if (accepting) {
+        dfa.addAcceptingState(dfaState);
+        if (rule != -1) {
+            dfa.setAcceptRule(dfaState, rule);
+        }
+    }
+}
+
+/**
+ * @brief Fingerprint of a set of NFA states (FNV-1a over the member ids)
+ */
+size_t fingerprint(const set<int>& states) {
+    size_t hash = 14695981039346656037ULL;
+    for (int state : states) {
+        hash ^= static_cast<size_t>(state);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Concurrent map from NFA state sets to provisional DFA state ids
+ *
+ * Lock striping on the fingerprint keeps contention low: two threads only
+ * serialize when their sets hash to the same stripe.
+ */
+class StripedStateTable {
+private:
+    static const size_t STRIPE_COUNT = 64;
+    
+    struct Stripe {
+        mutex lock;
+        unordered_map<size_t, vector<pair<set<int>, int>>> buckets;  // fingerprint -> (set, id)
+    };
+    
+    Stripe stripes[STRIPE_COUNT];
+    atomic<int> nextId;
+    atomic<size_t> setBytes;
+    
+public:
+    StripedStateTable() : nextId(0), setBytes(0) {}
+    
+    // Returns the id of the set and whether this call inserted it
+    pair<int, bool> intern(const set<int>& states) {
+        size_t hash = fingerprint(states);
+        Stripe& stripe = stripes[hash % STRIPE_COUNT];
+        lock_guard<mutex> guard(stripe.lock);
+        
+        vector<pair<set<int>, int>>& bucket = stripe.buckets[hash];
+        for (const auto& entry : bucket) {
+            if (entry.first == states) {
+                return {entry.second, false};
+            }
+        }
+        int id = nextId++;
+        bucket.push_back({states, id});
+        setBytes += stateSetBytes(states) + treeBytes<pair<const set<int>, int>>(1);
+        return {id, true};
+    }
+    
+    int size() const { return nextId.load(); }
+    size_t bytes() const { return setBytes.load(); }
+};
+
+/**
+ * @brief Run body(0..count-1) on up to threadCount worker threads
+ */
+void parallelFor(size_t count, unsigned threadCount, const function<void(size_t)>& body) {
+    if (threadCount == 0) {
+        threadCount = max(1u, thread::hardware_concurrency());
+    }
+    threadCount = static_cast<unsigned>(min<size_t>(threadCount, count));
+    
+    if (threadCount <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+    
+    atomic<size_t> nextIndex(0);
+    vector<thread> workers;
+    for (unsigned t = 0; t < threadCount; t++) {
+        workers.emplace_back([&]() {
+            TraceScope trace("thread", "worker");
+            for (size_t i = nextIndex++; i < count; i = nextIndex++) {
+                body(i);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+string stemOf(const string& path) {
+    string base = withoutExtension(path);
+    size_t slash = base.find_last_of('/');
+    return slash == string::npos ? base : base.substr(slash + 1);
+}
+
+// C identifier built from a file name, used to namespace emitted symbols
+string identifierFrom(const string& name) {
+    string identifier;
+    for (char c : name) {
+        identifier += isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    }
+    if (identifier.empty() || isdigit(static_cast<unsigned char>(identifier[0]))) {
+        identifier = "lexer_" + identifier;
+    }
+    return identifier;
+}
+
+/**
+ * @brief Token-kind macro names for a C header, one per token name
+ *
+ * Names that differ only in non-identifier characters (A-B and A_B) would
+ * sanitize to the same macro, and some would land on the header's own
+ * GUARD_H/GUARD_API-style macros; those get the kind index appended.
+ */
+vector<string> tokenKindMacros(const string& guard, const vector<string>& tokenNames) {
+    set<string> taken;
+    for (const char* reserved : {"H", "API", "MAIN", "MAX_INPUT", "MAX_TOKENS", "STATE_COUNTERS"}) {
+        taken.insert(guard + "_" + reserved);
+    }
+    vector<string> macros;
+    for (size_t i = 0; i < tokenNames.size(); i++) {
+        string macro = guard + "_" + identifierFrom(tokenNames[i]);
+        while (taken.count(macro)) {
+            macro += "_" + to_string(i);
+        }
+        taken.insert(macro);
+        macros.push_back(macro);
+    }
+    return macros;
+}
+
+/**
+ * @brief Output file that batches writes into large blocks
+ *
+ * Generated files can reach hundreds of megabytes, so text is collected in
+ * memory and handed to the stream in big chunks instead of flushing per line.
+ */
+class BufferedWriter {
+private:
+    static const size_t FLUSH_THRESHOLD = 1 << 20;
+    ofstream out;
+    string buffer;
+    size_t written;
+    
+    void flushIfFull() {
+        if (buffer.size() >= FLUSH_THRESHOLD) {
+            out.write(buffer.data(), buffer.size());
+            written += buffer.size();
+            buffer.clear();
+        }
+    }
+    
+public:
+    explicit BufferedWriter(const string& filename) : out(filename, ios::binary), written(0) {
+        buffer.reserve(FLUSH_THRESHOLD + 4096);
+    }
+    
+    bool isOpen() const { return out.is_open(); }
+    
+    BufferedWriter& operator<<(const string& text) {
+        buffer += text;
+        flushIfFull();
+        return *this;
+    }
+    
+    BufferedWriter& operator<<(const char* text) {
+        buffer += text;
+        flushIfFull();
+        return *this;
+    }
+    
+    BufferedWriter& operator<<(char c) {
+        buffer += c;
+        return *this;
+    }
+    
+    BufferedWriter& operator<<(long long value) {
+        char digits[24];
+        int length = snprintf(digits, sizeof(digits), "%lld", value);
+        buffer.append(digits, length);
+        flushIfFull();
+        return *this;
+    }
+    
+    BufferedWriter& operator<<(int value) { return *this << static_cast<long long>(value); }
+    BufferedWriter& operator<<(size_t value) { return *this << static_cast<long long>(value); }
+    
+    // Write out everything; false if the stream failed at any point
+    bool close() {
+        out.write(buffer.data(), buffer.size());
+        written += buffer.size();
+        buffer.clear();
+        out.close();
+        return !out.fail();
+    }
+    
+    size_t bytesWritten() const { return written + buffer.size(); }
+};
+
+// Comma-separated array body, perLine values per line
+void writeIntArray(BufferedWriter& out, const vector<int>& values, int perLine) {
+    for (size_t i = 0; i < values.size(); i++) {
+        if (i % perLine == 0) out << "\n    ";
+        out << values[i] << ',';
+    }
+    out << '\n';
+}
+
+// Narrowest <stdint.h> type holding every value in [minValue, maxValue]
+string smallestIntType(int minValue, int maxValue) {
+    if (minValue >= 0 && maxValue <= 255) return "uint8_t";
+    if (minValue >= -128 && maxValue <= 127) return "int8_t";
+    if (minValue >= 0 && maxValue <= 65535) return "uint16_t";
+    if (minValue >= -32768 && maxValue <= 32767) return "int16_t";
+    return "int32_t";
+}
+
+// Bytes per element of "int" or a type from smallestIntType
+size_t cTypeBytes(const string& type) {
+    if (type == "uint8_t" || type == "int8_t") return 1;
+    if (type == "uint16_t" || type == "int16_t") return 2;
+    return 4;
+}
+
+// C/C++ string literal for text: quotes, backslashes and non-printable bytes
+// escaped (octal, so a following digit cannot extend the escape)
+string cStringLiteral(const string& text) {
+    string result = "\"";
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += static_cast<char>(c);
+        } else if (c < 0x20 || c >= 0x7f) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\%03o", c);
+            result += escaped;
+        } else {
+            result += static_cast<char>(c);
+        }
+    }
+    return result + "\"";
+}
+
+/**
+ * @brief Table constants, byte classes and token kinds shared by all emitters
+ *
+ * Constants are emitted as an enum so the block is valid C as well as C++.
+ * Returns the bytes of the BYTE_CLASS and TOKEN_KIND arrays it wrote.
+ */
+size_t writeTableData(BufferedWriter& out, const FlatTable& table, int startState,
+                      const vector<int>& tokenKind, const vector<string>& tokenNames,
+                      bool compactTypes = false) {
+    string classType = compactTypes ? smallestIntType(0, table.classCount - 1) : "int";
+    string kindType = compactTypes ? smallestIntType(-1, static_cast<int>(tokenNames.size())) : "int";
+    out << "\n// DFA tables\n";
+    out << "enum {\n";
+    out << "    START_STATE = " << startState << ",\n";
+    out << "    NUM_STATES = " << table.stateCount << ",\n";
+    out << "    DEAD_STATE = " << table.deadState << ",\n";
+    out << "    NUM_CLASSES = " << table.classCount << ",\n";
+    out << "    NUM_TOKEN_KINDS = " << max<size_t>(1, tokenNames.size()) << "\n";
+    out << "};\n";
+    out << "\n// Byte -> column of the transition table\n";
+    out << "static const " << classType << " BYTE_CLASS[256] = {";
+    writeIntArray(out, table.byteClass, 16);
+    out << "};\n";
+    
+    out << "\nstatic const char* const TOKEN_NAMES[NUM_TOKEN_KINDS] = {";
+    if (tokenNames.empty()) {
+        out << "\"\"";
+    }
+    for (size_t i = 0; i < tokenNames.size(); i++) {
+        out << (i ? ", " : "") << cStringLiteral(tokenNames[i]);
+    }
+    out << "};\n";
+    out << "\n// State -> index into TOKEN_NAMES, -1 if not accepting\n";
+    out << "static const " << kindType << " TOKEN_KIND[NUM_STATES] = {";
+    writeIntArray(out, tokenKind, 16);
+    out << "};\n";
+    return 256 * cTypeBytes(classType) + tokenKind.size() * cTypeBytes(kindType);
+}
+
+/**
+ * @brief Longest-match loop of the emitted scanners
+ *
+ * Reads input[pos..length) and leaves the result in lastAcceptState /
+ * lastAcceptEnd. States in directStates become labelled blocks with a
+ * switch over the byte (direct-coded); the others step through TRANSITIONS.
+ */
+void writeMatchBlock(BufferedWriter& out, const FlatTable& table, const vector<int>& tokenKind,
+                     int startState, const set<int>& directStates) {
+    if (directStates.empty()) {
+        out << "        int state = START_STATE;\n";
+        out << "        for (size_t i = pos; i < length; i++) {\n";
+        out << "            state = TRANSITIONS[state * NUM_CLASSES + BYTE_CLASS[static_cast<unsigned char>(input[i])]];\n";
+        out << "            if (state == DEAD_STATE) break;\n";
+        out << "            if (TOKEN_KIND[state] != -1) {\n";
+        out << "                lastAcceptState = state;\n";
+        out << "                lastAcceptEnd = i + 1;\n";
+        out << "            }\n";
+        out << "        }\n";
+        return;
+    }
+    
+    bool hasTableStates = static_cast<int>(directStates.size()) < table.deadState;
+    
+    // Only emit labels something jumps to, so the generated code compiles warning-free
+    set<int> enteredDirectly;
+    for (int state : directStates) {
+        for (int byte = 0; byte < 256; byte++) {
+            int target = table.next[static_cast<size_t>(state) * table.classCount + table.byteClass[byte]];
+            if (directStates.count(target)) {
+                enteredDirectly.insert(target);
+            }
+        }
+    }
+    
+    out << "        {\n";
+    out << "        size_t i = pos;\n";
+    out << "        int state = START_STATE;\n";
+    if (directStates.count(startState)) {
+        out << "        goto run_" << startState << ";\n";
+    } else {
+        out << "        goto table_step;\n";
+    }
+    
+    if (hasTableStates) {
+        // Reached a state through the table (or a direct state leaving to a cold one)
+        out << "    dispatch:\n";
+        out << "        if (state == DEAD_STATE) goto done;\n";
+        out << "        if (TOKEN_KIND[state] != -1) {\n";
+        out << "            lastAcceptState = state;\n";
+        out << "            lastAcceptEnd = i;\n";
+        out << "        }\n";
+        out << "        switch (state) {\n";
+        for (int state : directStates) {
+            out << "            case " << state << ": goto run_" << state << ";\n";
+        }
+        out << "            default: break;\n";
+        out << "        }\n";
+        if (!directStates.count(startState)) {
+            out << "    table_step:\n";
+        }
+        out << "        if (i >= length) goto done;\n";
+        out << "        state = TRANSITIONS[state * NUM_CLASSES + BYTE_CLASS[static_cast<unsigned char>(input[i++])]];\n";
+        out << "        goto dispatch;\n";
+    }
+    
+    for (int state : directStates) {
+        if (enteredDirectly.count(state)) {
+            out << "    state_" << state << ":\n";
+            if (tokenKind[state] != -1) {
+                out << "        lastAcceptState = " << state << ";\n";
+                out << "        lastAcceptEnd = i;\n";
+            }
+        }
+        if (hasTableStates || state == startState) {
+            out << "    run_" << state << ":\n";
+        }
+        out << "        if (i >= length) goto done;\n";
+        out << "        switch (static_cast<unsigned char>(input[i++])) {\n";
+        
+        // Group the bytes by target so each target gets one case list
+        map<int, vector<int>> bytesByTarget;
+        for (int byte = 0; byte < 256; byte++) {
+            int target = table.next[static_cast<size_t>(state) * table.classCount + table.byteClass[byte]];
+            if (target != table.deadState) {
+                bytesByTarget[target].push_back(byte);
+            }
+        }
+        for (const auto& group : bytesByTarget) {
+            out << "           ";
+            for (int byte : group.second) {
+                out << " case " << byte << ":";
+            }
+            if (directStates.count(group.first)) {
+                out << " goto state_" << group.first << ";\n";
+            } else {
+                out << " state = " << group.first << "; goto dispatch;\n";
+            }
+        }
+        out << "            default: goto done;\n";
+        out << "        }\n";
+    }
+    
+    out << "    done:\n";
+    out << "        (void)state;\n";
+    out << "        }\n";
+}
+
+} // namespace
+
 // ==================== DFA Implementation ====================
 
 DFA::DFA() : startState(0) {}
 
-DFA DFA::fromNFA(const NFA& nfa) {
+DFA DFA::fromNFA(const NFA& nfa, BuildStats* stats) {
     DFA dfa;
     
     // Get alphabet from NFA (excluding epsilon)
@@ -285,61 +939,173 @@ DFA DFA::fromNFA(const NFA& nfa) {
     }
     dfa.alphabet = alphabet;
     
+    // Index outgoing edges once so each DFA state is expanded in a single pass
+    NFAAdjacency adjacency(nfa);
+    
     // Map from set of NFA states to DFA state ID
     map<set<int>, int> dfaStateMap;
     queue<set<int>> unmarkedStates;
     int dfaStateCounter = 0;
     
+    // Bytes of the interned sets (dfaStateMap) and of the worklist copies in
+    // the queue, sampled when a BFS level is done, as fromNFAParallel does
+    size_t internedBytes = 0, worklistBytes = 0, peakSetBytes = 0;
+    auto discovered = [&](const set<int>& states) {
+        internedBytes += stateSetBytes(states) + treeBytes<pair<const set<int>, int>>(1);
+        worklistBytes += stateSetBytes(states);
+    };
+    int levelLast = 0;  // highest id of the level being expanded
+    
     // Start with epsilon closure of NFA start state
-    set<int> startClosure = nfa.epsilonClosure(nfa.getStartState());
+    SubsetCounts counts;
+    set<int> startClosure = adjacency.closure({nfa.getStartState()}, counts);
     dfaStateMap[startClosure] = dfaStateCounter++;
     unmarkedStates.push(startClosure);
+    discovered(startClosure);
     dfa.setStartState(0);
     dfa.addState(0);
     
     // Check if start state is accepting
-    for (int nfaState : startClosure) {
-        if (nfa.getAcceptingStates().count(nfaState)) {
-            dfa.addAcceptingState(0);
-            break;
-        }
-    }
+    classifyState(dfa, 0, startClosure, nfa);
     
     // Subset construction algorithm
     while (!unmarkedStates.empty()) {
         set<int> currentStates = unmarkedStates.front();
         unmarkedStates.pop();
+        worklistBytes -= stateSetBytes(currentStates);
         
         int currentDfaState = dfaStateMap[currentStates];
         
-        // For each symbol in alphabet
-        for (char symbol : alphabet) {
-            set<int> moveResult = nfa.move(currentStates, symbol);
-            set<int> newStates = nfa.epsilonClosure(moveResult);
-            
-            if (newStates.empty()) continue;
+        // Only symbols that actually leave the current set produce successors
+        for (const auto& successor : adjacency.successors(currentStates, counts)) {
+            char symbol = successor.first;
+            const set<int>& newStates = successor.second;
             
             // Check if this set of states already exists
-            if (dfaStateMap.find(newStates) == dfaStateMap.end()) {
+            auto found = dfaStateMap.find(newStates);
+            if (found == dfaStateMap.end()) {
                 int newDfaState = dfaStateCounter++;
-                dfaStateMap[newStates] = newDfaState;
+                found = dfaStateMap.insert({newStates, newDfaState}).first;
                 unmarkedStates.push(newStates);
+                discovered(newStates);
                 dfa.addState(newDfaState);
                 
                 // Check if new state is accepting
-                for (int nfaState : newStates) {
-                    if (nfa.getAcceptingStates().count(nfaState)) {
-                        dfa.addAcceptingState(newDfaState);
-                        break;
-                    }
-                }
+                classifyState(dfa, newDfaState, newStates, nfa);
             }
             
-            int nextDfaState = dfaStateMap[newStates];
-            dfa.addTransition(currentDfaState, symbol, nextDfaState);
+            dfa.addTransition(currentDfaState, symbol, found->second);
+        }
+        
+        if (currentDfaState == levelLast) {
+            peakSetBytes = max(peakSetBytes, internedBytes + worklistBytes);
+            levelLast = dfaStateCounter - 1;
+        }
+    }
+    
+    counts.addTo(stats);
+    if (stats) {
+        stats->subsetSetBytesPeak = max(stats->subsetSetBytesPeak, peakSetBytes);
+    }
+    return dfa;
+}
+
+DFA DFA::fromNFAParallel(const NFA& nfa, unsigned threadCount, BuildStats* stats) {
+    DFA dfa;
+    
+    // Get alphabet from NFA (excluding epsilon)
+    for (const auto& trans : nfa.getTransitions()) {
+        if (trans.symbol != '\0') {
+            dfa.alphabet.insert(trans.symbol);
+        }
+    }
+    
+    NFAAdjacency adjacency(nfa);
+    
+    // Successor of one frontier state, expressed with provisional ids
+    struct Expansion {
+        vector<pair<char, int>> edges;                   // (symbol, provisional id)
+        vector<pair<int, set<int>>> discovered;          // sets first seen here
+        SubsetCounts counts;                             // work for this state only
+    };
+    
+    StripedStateTable table;
+    vector<int> provisionalToFinal;
+    
+    SubsetCounts counts;
+    set<int> startClosure = adjacency.closure({nfa.getStartState()}, counts);
+    table.intern(startClosure);
+    provisionalToFinal.push_back(0);
+    dfa.setStartState(0);
+    dfa.addState(0);
+    classifyState(dfa, 0, startClosure, nfa);
+    
+    // Expand the frontier level by level; states of one level are expanded
+    // concurrently, then numbered in the order the sequential BFS would use
+    vector<set<int>> frontier;
+    frontier.push_back(startClosure);
+    int firstFrontierId = 0;
+    int dfaStateCounter = 1;
+    size_t peakSetBytes = 0;
+    
+    while (!frontier.empty()) {
+        TraceScope trace("build", "subset level");
+        vector<Expansion> expansions(frontier.size());
+        
+        parallelFor(frontier.size(), threadCount, [&](size_t index) {
+            Expansion& expansion = expansions[index];
+            for (auto& successor : adjacency.successors(frontier[index], expansion.counts)) {
+                pair<int, bool> interned = table.intern(successor.second);
+                expansion.edges.push_back({successor.first, interned.first});
+                if (interned.second) {
+                    expansion.discovered.push_back({interned.first, move(successor.second)});
+                }
+            }
+        });
+        
+        // Collect the sets created during this level by provisional id
+        map<int, set<int>*> newSets;
+        for (auto& expansion : expansions) {
+            counts += expansion.counts;
+            for (auto& created : expansion.discovered) {
+                newSets[created.first] = &created.second;
+            }
+        }
+        provisionalToFinal.resize(table.size(), -1);
+        
+        // Deterministic renumbering in frontier order, then symbol order
+        vector<set<int>> nextFrontier;
+        for (size_t index = 0; index < frontier.size(); index++) {
+            int currentDfaState = firstFrontierId + static_cast<int>(index);
+            for (const auto& edge : expansions[index].edges) {
+                int& finalId = provisionalToFinal[edge.second];
+                if (finalId == -1) {
+                    finalId = dfaStateCounter++;
+                    set<int>& states = *newSets[edge.second];
+                    dfa.addState(finalId);
+                    classifyState(dfa, finalId, states, nfa);
+                    nextFrontier.push_back(move(states));
+                }
+                dfa.addTransition(currentDfaState, edge.first, finalId);
+            }
+        }
+        
+        // Interned sets plus the worklist (the next frontier) once the level is
+        // done, the same quantity fromNFA samples
+        size_t worklistBytes = 0;
+        for (const auto& states : nextFrontier) {
+            worklistBytes += stateSetBytes(states);
         }
+        peakSetBytes = max(peakSetBytes, table.bytes() + worklistBytes);
+        
+        firstFrontierId += static_cast<int>(frontier.size());
+        frontier.swap(nextFrontier);
     }
     
+    counts.addTo(stats);
+    if (stats) {
+        stats->subsetSetBytesPeak = max(stats->subsetSetBytesPeak, peakSetBytes);
+    }
     return dfa;
 }
 
@@ -371,10 +1137,31 @@ void DFA::addAcceptingState(int stateId) {
     }
 }
 
+void DFA::removeAcceptingState(int stateId) {
+    acceptingStates.erase(stateId);
+    stateToTokenType.erase(stateId);
+    stateToRule.erase(stateId);
+    for (auto& state : states) {
+        if (state.id == stateId) {
+            state.isAccepting = false;
+            break;
+        }
+    }
+}
+
 void DFA::setTokenType(int stateId, const string& tokenType) {
     stateToTokenType[stateId] = tokenType;
 }
 
+void DFA::setAcceptRule(int stateId, int ruleIndex) {
+    stateToRule[stateId] = ruleIndex;
+}
+
+int DFA::getAcceptRule(int stateId) const {
+    auto it = stateToRule.find(stateId);
+    return it != stateToRule.end() ? it->second : -1;
+}
+
 int DFA::getNextState(int currentState, char symbol) const {
     auto it = transitions.find({currentState, symbol});
     if (it != transitions.end()) {
@@ -434,277 +1221,3227 @@ void DFA::display() const {
     cout << "===================================" << endl;
 }
 
-void DFA::generateCppCode(const string& filename, const map<string, string>& tokenPatterns) const {
-    ofstream outFile(filename);
-    
-    if (!outFile.is_open()) {
-        cerr << "Error: Could not open file " << filename << " for writing." << endl;
-        return;
-    }
+vector<int> DFA::tokenKinds(int stateCount, vector<string>& tokenNames) const {
+    vector<int> kinds(stateCount, -1);
+    map<string, int> kindOf;
     
-    // Write header and includes
-    outFile << "// Auto-generated Lexical Analyzer" << endl;
-    outFile << "// Generated on: " << __DATE__ << " " << __TIME__ << endl;
-    outFile << "\n#include <iostream>" << endl;
-    outFile << "#include <string>" << endl;
-    outFile << "#include <vector>" << endl;
-    outFile << "#include <map>" << endl;
-    outFile << "using namespace std;" << endl;
-    outFile << "\n// Token structure" << endl;
-    outFile << "struct Token {" << endl;
-    outFile << "    string type;" << endl;
-    outFile << "    string lexeme;" << endl;
-    outFile << "    int line;" << endl;
-    outFile << "    int column;" << endl;
-    outFile << "};" << endl;
-    
-    // Write DFA transition table
-    outFile << "\n// DFA Transition Table" << endl;
-    outFile << "class LexicalAnalyzer {" << endl;
-    outFile << "private:" << endl;
-    outFile << "    static const int START_STATE = " << startState << ";" << endl;
-    outFile << "    map<pair<int, char>, int> transitionTable;" << endl;
-    outFile << "    map<int, bool> acceptingStates;" << endl;
-    outFile << "    map<int, string> stateToToken;" << endl;
-    outFile << "    \n    void initializeTransitionTable() {" << endl;
-    
-    // Add transitions
+    for (int state : acceptingStates) {
+        auto it = stateToTokenType.find(state);
+        string tokenType = it != stateToTokenType.end() ? it->second : "";
+        auto found = kindOf.find(tokenType);
+        if (found == kindOf.end()) {
+            found = kindOf.insert({tokenType, static_cast<int>(tokenNames.size())}).first;
+            tokenNames.push_back(tokenType);
+        }
+        kinds[state] = found->second;
+    }
+    
+    return kinds;
+}
+
+DFA DFA::renumbered(const vector<int>& order) const {
+    vector<int> newId(order.size(), -1);
+    for (size_t i = 0; i < order.size(); i++) {
+        newId[order[i]] = static_cast<int>(i);
+    }
+    
+    DFA result;
+    result.alphabet = alphabet;
+    result.setStartState(newId[startState]);
+    for (size_t i = 0; i < order.size(); i++) {
+        result.addState(static_cast<int>(i), acceptingStates.count(order[i]) > 0);
+    }
+    for (const auto& trans : transitions) {
+        result.transitions[{newId[trans.first.first], trans.first.second}] = newId[trans.second];
+    }
+    for (const auto& tokenType : stateToTokenType) {
+        result.stateToTokenType[newId[tokenType.first]] = tokenType.second;
+    }
+    for (const auto& rule : stateToRule) {
+        result.stateToRule[newId[rule.first]] = rule.second;
+    }
+    
+    return result;
+}
+
+DFA DFA::pruned() const {
+    int stateCount = static_cast<int>(states.size());
+    if (stateCount == 0) {
+        return *this;
+    }
+    
+    vector<vector<int>> successors(stateCount), predecessors(stateCount);
+    for (const auto& trans : transitions) {
+        successors[trans.first.first].push_back(trans.second);
+        predecessors[trans.second].push_back(trans.first.first);
+    }
+    
+    // Forward from the start state, backward from the accepting states
+    auto markFrom = [](const vector<int>& roots, const vector<vector<int>>& edges, vector<bool>& marked) {
+        stack<int> pending;
+        for (int root : roots) {
+            if (!marked[root]) {
+                marked[root] = true;
+                pending.push(root);
+            }
+        }
+        while (!pending.empty()) {
+            int current = pending.top();
+            pending.pop();
+            for (int next : edges[current]) {
+                if (!marked[next]) {
+                    marked[next] = true;
+                    pending.push(next);
+                }
+            }
+        }
+    };
+    
+    vector<bool> reachable(stateCount, false), productive(stateCount, false);
+    markFrom({startState}, successors, reachable);
+    markFrom(vector<int>(acceptingStates.begin(), acceptingStates.end()), predecessors, productive);
+    
+    vector<int> newId(stateCount, -1);
+    int kept = 0;
+    for (int state = 0; state < stateCount; state++) {
+        if (state == startState || (reachable[state] && productive[state])) {
+            newId[state] = kept++;
+        }
+    }
+    
+    DFA result;
+    result.alphabet = alphabet;
+    result.setStartState(newId[startState]);
+    for (int state = 0; state < stateCount; state++) {
+        if (newId[state] != -1) {
+            result.addState(newId[state], acceptingStates.count(state) > 0);
+        }
+    }
+    // Transitions into dropped states simply disappear: they fall into the dead row
+    for (const auto& trans : transitions) {
+        int from = newId[trans.first.first], to = newId[trans.second];
+        if (from != -1 && to != -1) {
+            result.transitions[{from, trans.first.second}] = to;
+        }
+    }
+    for (const auto& tokenType : stateToTokenType) {
+        if (newId[tokenType.first] != -1) {
+            result.stateToTokenType[newId[tokenType.first]] = tokenType.second;
+        }
+    }
+    for (const auto& rule : stateToRule) {
+        if (newId[rule.first] != -1) {
+            result.stateToRule[newId[rule.first]] = rule.second;
+        }
+    }
+    
+    return result;
+}
+
+vector<int> DFA::localityOrder(const map<pair<int, int>, uint64_t>* taken) const {
+    int stateCount = static_cast<int>(states.size());
+    
+    // Successor weights: how often each transition was taken in the profile,
+    // else how many bytes lead from a state to each target
+    vector<map<int, uint64_t>> successorWeights(stateCount);
+    if (taken) {
+        for (const auto& edge : *taken) {
+            int from = edge.first.first, to = edge.first.second;
+            if (edge.second && from >= 0 && from < stateCount && to >= 0 && to < stateCount) {
+                successorWeights[from][to] += edge.second;
+            }
+        }
+    } else {
+        for (const auto& trans : transitions) {
+            successorWeights[trans.first.first][trans.second]++;
+        }
+    }
+    
+    vector<int> order;
+    vector<bool> placed(stateCount, false);
+    queue<int> pending;
+    
+    order.push_back(startState);
+    placed[startState] = true;
+    pending.push(startState);
+    
+    while (!pending.empty()) {
+        int current = pending.front();
+        pending.pop();
+        
+        // Self-loops need no placement; the heaviest other successors go next
+        vector<pair<uint64_t, int>> successors;  // (weight, target)
+        for (const auto& successor : successorWeights[current]) {
+            if (!placed[successor.first]) {
+                successors.push_back({successor.second, successor.first});
+            }
+        }
+        sort(successors.begin(), successors.end(), [](const pair<uint64_t, int>& a, const pair<uint64_t, int>& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+        
+        for (const auto& successor : successors) {
+            placed[successor.second] = true;
+            order.push_back(successor.second);
+            pending.push(successor.second);
+        }
+    }
+    
+    // States unreachable from the start (or never entered) keep their relative order at the end
+    for (int state = 0; state < stateCount; state++) {
+        if (!placed[state]) {
+            order.push_back(state);
+        }
+    }
+    
+    return order;
+}
+
+uint64_t DFA::fingerprint() const {
+    // FNV-1a over the structure, one 64-bit value at a time
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash](uint64_t value) {
+        for (int shift = 0; shift < 64; shift += 8) {
+            hash = (hash ^ ((value >> shift) & 0xff)) * 1099511628211ULL;
+        }
+    };
+    mix(states.size());
+    mix(static_cast<uint64_t>(startState));
+    for (const auto& trans : transitions) {
+        mix(static_cast<uint64_t>(trans.first.first));
+        mix(static_cast<unsigned char>(trans.first.second));
+        mix(static_cast<uint64_t>(trans.second));
+    }
+    for (const auto& tokenType : stateToTokenType) {
+        mix(static_cast<uint64_t>(tokenType.first));
+        for (char c : tokenType.second) {
+            mix(static_cast<unsigned char>(c));
+        }
+    }
+    for (const auto& rule : stateToRule) {
+        mix(static_cast<uint64_t>(rule.first));
+        mix(static_cast<uint64_t>(rule.second));
+    }
+    return hash;
+}
+
+bool DFA::equivalent(const DFA& first, const DFA& second, string* counterexample) {
+    // Both automata in one id space: first's states, its dead state, then
+    // second's states and its dead state. Missing transitions go to the dead state
+    int firstCount = static_cast<int>(first.states.size());
+    int secondCount = static_cast<int>(second.states.size());
+    int secondBase = firstCount + 1;
+    int total = secondBase + secondCount + 1;
+    
+    vector<int> next(static_cast<size_t>(total) * 256);
+    vector<string> label(total);
+    auto load = [&](const DFA& dfa, int base, int count) {
+        for (int state = base; state <= base + count; state++) {
+            fill(next.begin() + static_cast<size_t>(state) * 256, next.begin() + static_cast<size_t>(state + 1) * 256,
+                 base + count);
+        }
+        for (const auto& trans : dfa.transitions) {
+            next[static_cast<size_t>(base + trans.first.first) * 256 + static_cast<unsigned char>(trans.first.second)] =
+                base + trans.second;
+        }
+        for (int state : dfa.acceptingStates) {
+            int rule = dfa.getAcceptRule(state);
+            auto tokenType = dfa.stateToTokenType.find(state);
+            label[base + state] = rule != -1 ? "rule " + to_string(rule)
+                                : tokenType != dfa.stateToTokenType.end() ? tokenType->second : "accept";
+        }
+    };
+    load(first, 0, firstCount);
+    load(second, secondBase, secondCount);
+    
+    vector<int> parent(total);
+    for (int state = 0; state < total; state++) {
+        parent[state] = state;
+    }
+    function<int(int)> find = [&](int state) {
+        while (parent[state] != state) {
+            parent[state] = parent[parent[state]];
+            state = parent[state];
+        }
+        return state;
+    };
+    
+    // Breadth-first over merged pairs, so the first mismatch has a shortest witness
+    struct Pair {
+        int left, right;
+        int from;      // index of the pair this one was reached from, -1 for the starts
+        char symbol;
+    };
+    vector<Pair> pairs;
+    size_t head = 0;
+    
+    auto witness = [&](int index) {
+        if (counterexample) {
+            string input;
+            for (; pairs[index].from != -1; index = pairs[index].from) {
+                input += pairs[index].symbol;
+            }
+            counterexample->assign(input.rbegin(), input.rend());
+        }
+        return false;
+    };
+    
+    int firstStart = firstCount ? first.startState : firstCount;
+    int secondStart = secondBase + (secondCount ? second.startState : secondCount);
+    pairs.push_back({firstStart, secondStart, -1, '\0'});
+    parent[find(firstStart)] = find(secondStart);
+    if (label[firstStart] != label[secondStart]) {
+        return witness(0);
+    }
+    
+    while (head < pairs.size()) {
+        int current = static_cast<int>(head++);
+        int left = pairs[current].left, right = pairs[current].right;
+        for (int byte = 0; byte < 256; byte++) {
+            int leftNext = next[static_cast<size_t>(left) * 256 + byte];
+            int rightNext = next[static_cast<size_t>(right) * 256 + byte];
+            int leftRoot = find(leftNext), rightRoot = find(rightNext);
+            if (leftRoot == rightRoot) continue;
+            
+            parent[leftRoot] = rightRoot;
+            pairs.push_back({leftNext, rightNext, current, static_cast<char>(byte)});
+            if (label[leftNext] != label[rightNext]) {
+                return witness(static_cast<int>(pairs.size()) - 1);
+            }
+        }
+    }
+    
+    return true;
+}
+
+size_t DFA::memoryBytes() const {
+    size_t bytes = states.capacity() * sizeof(State);
+    for (const auto& state : states) {
+        bytes += stringBytes(state.tokenType);
+    }
+    bytes += treeBytes<pair<const pair<int, char>, int>>(transitions.size());
+    bytes += treeBytes<int>(acceptingStates.size()) + treeBytes<char>(alphabet.size());
+    bytes += treeBytes<pair<const int, string>>(stateToTokenType.size());
+    for (const auto& tokenType : stateToTokenType) {
+        bytes += stringBytes(tokenType.second);
+    }
+    return bytes + treeBytes<pair<const int, int>>(stateToRule.size());
+}
+
+double DFA::meanSuccessorDistance() const {
+    if (transitions.empty()) {
+        return 0;
+    }
+    double total = 0;
     for (const auto& trans : transitions) {
-        outFile << "        transitionTable[{" << trans.first.first << ", '" 
-                << trans.first.second << "'}] = " << trans.second << ";" << endl;
+        total += abs(trans.first.first - trans.second);
+    }
+    return total / transitions.size();
+}
+
+int DFA::byteClasses(vector<int>& byteClass) const {
+    int stateCount = 0;
+    for (const auto& state : states) {
+        stateCount = max(stateCount, state.id + 2);  // plus the dead row
+    }
+    
+    // Partition refinement over bytes: two bytes stay in the same class only
+    // while every state sends them to the same target
+    byteClass.assign(256, 0);
+    vector<int> row(256, -1);
+    int classCount = 1;
+    auto trans = transitions.begin();
+    for (int state = 0; state < stateCount; state++) {
+        if (trans == transitions.end() || trans->first.first != state) continue;
+        
+        fill(row.begin(), row.end(), -1);
+        for (; trans != transitions.end() && trans->first.first == state; ++trans) {
+            row[static_cast<unsigned char>(trans->first.second)] = trans->second;
+        }
+        
+        unordered_map<long long, int> split;
+        vector<int> refined(256);
+        for (int byte = 0; byte < 256; byte++) {
+            long long key = static_cast<long long>(byteClass[byte]) * (stateCount + 1) + row[byte] + 1;
+            auto found = split.insert({key, static_cast<int>(split.size())}).first;
+            refined[byte] = found->second;
+        }
+        byteClass.swap(refined);
+        classCount = static_cast<int>(split.size());
+    }
+    return classCount;
+}
+
+FlatTable DFA::buildFlatTable() const {
+    FlatTable table;
+    for (const auto& state : states) {
+        table.deadState = max(table.deadState, state.id + 1);
+    }
+    table.stateCount = table.deadState + 1;
+    table.classCount = byteClasses(table.byteClass);
+    
+    table.next.assign(static_cast<size_t>(table.stateCount) * table.classCount, table.deadState);
+    for (const auto& entry : transitions) {
+        int column = table.byteClass[static_cast<unsigned char>(entry.first.second)];
+        table.next[static_cast<size_t>(entry.first.first) * table.classCount + column] = entry.second;
+    }
+    
+    return table;
+}
+
+vector<string> DFA::cppTableFiles(const string& filename, size_t maxTableEntriesPerFile) const {
+    // Same shape as buildFlatTable, without filling the table
+    int stateCount = 1;
+    for (const auto& state : states) {
+        stateCount = max(stateCount, state.id + 2);
+    }
+    vector<int> byteClass;
+    size_t classCount = byteClasses(byteClass);
+    size_t rowsPerChunk = max<size_t>(1, maxTableEntriesPerFile / classCount);
+    size_t chunkCount = (stateCount + rowsPerChunk - 1) / rowsPerChunk;
+    
+    vector<string> chunkFiles;
+    for (size_t chunk = 0; chunk < chunkCount && chunkCount > 1; chunk++) {
+        chunkFiles.push_back(withoutExtension(filename) + "_table_" + to_string(chunk) + ".cpp");
+    }
+    return chunkFiles;
+}
+
+bool DFA::generateCppCode(const string& filename, size_t maxTableEntriesPerFile, EmitReport* report) const {
+    TraceScope trace("emit", "emit cpp", filename);
+    auto started = chrono::steady_clock::now();
+    BufferedWriter outFile(filename);
+    
+    if (!outFile.isOpen()) {
+        cerr << "Error: Could not open file " << filename << " for writing." << endl;
+        return false;
+    }
+    
+    EmitReport emitted;
+    emitted.files.push_back(filename);
+    
+    FlatTable table = buildFlatTable();
+    vector<string> tokenNames;
+    vector<int> tokenKind = tokenKinds(table.stateCount, tokenNames);
+    
+    // Split the table by whole rows when it is too large for one file
+    size_t tableEntries = table.next.size();
+    size_t rowsPerChunk = max<size_t>(1, maxTableEntriesPerFile / table.classCount);
+    size_t chunkCount = (table.stateCount + rowsPerChunk - 1) / rowsPerChunk;
+    bool split = chunkCount > 1;
+    string prefix = identifierFrom(stemOf(filename));
+    
+    vector<string> chunkFiles = cppTableFiles(filename, maxTableEntriesPerFile);
+    
+    // Write header and includes
+    outFile << "// Auto-generated Lexical Analyzer\n";
+    outFile << "// Generated on: " << __DATE__ << " " << __TIME__ << "\n";
+    outFile << "// Transition table: " << table.stateCount << " states x " << table.classCount
+            << " byte classes (" << tableEntries << " entries)\n";
+    if (split) {
+        outFile << "// The table is split across " << chunkCount << " files; compile them together:\n";
+        outFile << "//   g++ -o lexer " << filename;
+        for (const string& chunkFile : chunkFiles) {
+            outFile << " " << chunkFile;
+        }
+        outFile << "\n";
+    }
+    outFile << "// Driver: lexer [FILE] prints tokens, --bench N FILE measures throughput,\n";
+    outFile << "// --stats FILE prints a token-kind histogram; -DLEXER_STATE_COUNTERS adds\n";
+    outFile << "// per-state hit counts to --stats\n";
+    outFile << "\n#include <algorithm>\n";
+    outFile << "#include <chrono>\n";
+    outFile << "#include <cstdlib>\n";
+    outFile << "#include <fstream>\n";
+    outFile << "#include <iostream>\n";
+    outFile << "#include <iterator>\n";
+    outFile << "#include <map>\n";
+    outFile << "#include <string>\n";
+    outFile << "#include <vector>\n";
+    outFile << "using namespace std;\n";
+    outFile << "\n// Token structure\n";
+    outFile << "struct Token {\n";
+    outFile << "    string type;\n";
+    outFile << "    string lexeme;\n";
+    outFile << "    int line;\n";
+    outFile << "    int column;\n";
+    outFile << "};\n";
+    
+    // Write DFA tables as plain data
+    emitted.tableBytes = writeTableData(outFile, table, startState, tokenKind, tokenNames) +
+                         table.next.size() * sizeof(int);
+    
+    outFile << "\n// Transition table rows (state * NUM_CLASSES + column); DEAD_STATE = no match\n";
+    if (split) {
+        outFile << "static const int ROWS_PER_CHUNK = " << rowsPerChunk << ";\n";
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            outFile << "extern const int " << prefix << "_transitions_" << chunk << "[];\n";
+        }
+        outFile << "static const int* const TRANSITION_CHUNKS[] = {";
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            outFile << (chunk ? ", " : "") << prefix << "_transitions_" << chunk;
+        }
+        outFile << "};\n";
+    } else {
+        outFile << "static const int TRANSITIONS[NUM_STATES * NUM_CLASSES] = {";
+        writeIntArray(outFile, table.next, table.classCount);
+        outFile << "};\n";
+    }
+    
+    outFile << "\n#ifdef LEXER_STATE_COUNTERS\n";
+    outFile << "// Times each state was entered\n";
+    outFile << "static unsigned long long STATE_HITS[NUM_STATES];\n";
+    outFile << "#endif\n";
+    
+    outFile << "\nclass LexicalAnalyzer {\n";
+    outFile << "private:\n";
+    outFile << "    int getNextState(int currentState, char symbol) const {\n";
+    outFile << "        int column = BYTE_CLASS[static_cast<unsigned char>(symbol)];\n";
+    if (split) {
+        outFile << "        return TRANSITION_CHUNKS[currentState / ROWS_PER_CHUNK]"
+                   "[(currentState % ROWS_PER_CHUNK) * NUM_CLASSES + column];\n";
+    } else {
+        outFile << "        return TRANSITIONS[currentState * NUM_CLASSES + column];\n";
+    }
+    outFile << "    }\n";
+    
+    // Write tokenize method (longest match, earliest rule on ties)
+    outFile << "\npublic:\n";
+    outFile << "    // Lexical errors go to cerr, or are only counted in *errors when given\n";
+    outFile << "    vector<Token> tokenize(const string& input, size_t* errors = nullptr) const {\n";
+    outFile << "        vector<Token> tokens;\n";
+    outFile << "        if (errors) *errors = 0;\n";
+    outFile << "        size_t pos = 0;\n";
+    outFile << "        int line = 1, column = 1;\n";
+    outFile << "        \n        while (pos < input.length()) {\n";
+    outFile << "            int currentState = START_STATE;\n";
+    outFile << "            int lastAcceptState = -1;\n";
+    outFile << "            size_t lastAcceptEnd = pos;\n";
+    outFile << "            \n            for (size_t i = pos; i < input.length(); i++) {\n";
+    outFile << "                currentState = getNextState(currentState, input[i]);\n";
+    outFile << "#ifdef LEXER_STATE_COUNTERS\n";
+    outFile << "                STATE_HITS[currentState]++;\n";
+    outFile << "#endif\n";
+    outFile << "                if (currentState == DEAD_STATE) break;\n";
+    outFile << "                if (TOKEN_KIND[currentState] != -1) {\n";
+    outFile << "                    lastAcceptState = currentState;\n";
+    outFile << "                    lastAcceptEnd = i + 1;\n";
+    outFile << "                }\n";
+    outFile << "            }\n";
+    outFile << "            \n            size_t end = lastAcceptEnd;\n";
+    outFile << "            if (lastAcceptState != -1) {\n";
+    outFile << "                Token token;\n";
+    outFile << "                token.type = TOKEN_NAMES[TOKEN_KIND[lastAcceptState]];\n";
+    outFile << "                token.lexeme = input.substr(pos, end - pos);\n";
+    outFile << "                token.line = line;\n";
+    outFile << "                token.column = column;\n";
+    outFile << "                tokens.push_back(token);\n";
+    outFile << "            } else {\n";
+    outFile << "                // Error: no valid token, skip one character\n";
+    outFile << "                char c = input[pos];\n";
+    outFile << "                if (c != ' ' && c != '\\t' && c != '\\n') {\n";
+    outFile << "                    if (errors) {\n";
+    outFile << "                        (*errors)++;\n";
+    outFile << "                    } else {\n";
+    outFile << "                        cerr << \"Lexical error at line \" << line << \", column \" << column << endl;\n";
+    outFile << "                    }\n";
+    outFile << "                }\n";
+    outFile << "                end = pos + 1;\n";
+    outFile << "            }\n";
+    outFile << "            \n            for (; pos < end; pos++) {\n";
+    outFile << "                if (input[pos] == '\\n') {\n";
+    outFile << "                    line++;\n";
+    outFile << "                    column = 1;\n";
+    outFile << "                } else {\n";
+    outFile << "                    column++;\n";
+    outFile << "                }\n";
+    outFile << "            }\n";
+    outFile << "        }\n";
+    outFile << "        \n        return tokens;\n";
+    outFile << "    }\n";
+    outFile << "};\n";
+    
+    // Driver: print tokens, or measure / summarize a file without harness code
+    outFile << "\n// The whole file, or stdin when path is null\n";
+    outFile << "static bool readInput(const char* path, string& input) {\n";
+    outFile << "    if (!path) {\n";
+    outFile << "        input.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());\n";
+    outFile << "        return true;\n";
+    outFile << "    }\n";
+    outFile << "    ifstream in(path, ios::binary);\n";
+    outFile << "    if (!in.is_open()) {\n";
+    outFile << "        cerr << \"Cannot read \" << path << endl;\n";
+    outFile << "        return false;\n";
+    outFile << "    }\n";
+    outFile << "    input.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());\n";
+    outFile << "    return true;\n";
+    outFile << "}\n";
+    
+    outFile << "\n// Lex input runs times after one warmup run, printing only the throughput\n";
+    outFile << "static int bench(const LexicalAnalyzer& analyzer, const string& input, int runs) {\n";
+    outFile << "    size_t errors = 0;\n";
+    outFile << "    size_t tokenCount = analyzer.tokenize(input, &errors).size();\n";
+    outFile << "    double best = 1e300, total = 0;\n";
+    outFile << "    for (int run = 0; run < runs; run++) {\n";
+    outFile << "        auto start = chrono::steady_clock::now();\n";
+    outFile << "        tokenCount = analyzer.tokenize(input, &errors).size();\n";
+    outFile << "        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();\n";
+    outFile << "        best = min(best, seconds);\n";
+    outFile << "        total += seconds;\n";
+    outFile << "    }\n";
+    outFile << "    double megabytes = input.size() / 1e6;\n";
+    outFile << "    cout << runs << \" runs over \" << input.size() << \" bytes, \" << tokenCount << \" tokens, \"\n";
+    outFile << "         << errors << \" errors\" << endl;\n";
+    outFile << "    cout << \"best: \" << megabytes / best << \" MB/s, \" << tokenCount / best / 1e6 << \" Mtokens/s\" << endl;\n";
+    outFile << "    cout << \"mean: \" << megabytes * runs / total << \" MB/s, \"\n";
+    outFile << "         << tokenCount * runs / total / 1e6 << \" Mtokens/s\" << endl;\n";
+    outFile << "    return 0;\n";
+    outFile << "}\n";
+    
+    outFile << "\n// Bytes, token and error counts, then tokens per kind, most frequent first\n";
+    outFile << "static int stats(const LexicalAnalyzer& analyzer, const string& input) {\n";
+    outFile << "    size_t errors = 0;\n";
+    outFile << "    vector<Token> tokens = analyzer.tokenize(input, &errors);\n";
+    outFile << "    map<string, size_t> counts;\n";
+    outFile << "    for (const auto& token : tokens) {\n";
+    outFile << "        counts[token.type]++;\n";
+    outFile << "    }\n";
+    outFile << "    vector<pair<size_t, string>> histogram;\n";
+    outFile << "    for (const auto& count : counts) {\n";
+    outFile << "        histogram.push_back({count.second, count.first});\n";
+    outFile << "    }\n";
+    outFile << "    sort(histogram.rbegin(), histogram.rend());\n";
+    outFile << "    \n    cout << \"bytes:  \" << input.size() << endl;\n";
+    outFile << "    cout << \"tokens: \" << tokens.size() << endl;\n";
+    outFile << "    cout << \"errors: \" << errors << endl;\n";
+    outFile << "    for (const auto& entry : histogram) {\n";
+    outFile << "        cout << \"  \" << entry.second << \" \" << entry.first << \" (\"\n";
+    outFile << "             << 100.0 * entry.first / tokens.size() << \"%)\" << endl;\n";
+    outFile << "    }\n";
+    outFile << "#ifdef LEXER_STATE_COUNTERS\n";
+    outFile << "    vector<pair<unsigned long long, int>> hits;\n";
+    outFile << "    for (int state = 0; state < NUM_STATES; state++) {\n";
+    outFile << "        if (STATE_HITS[state]) hits.push_back({STATE_HITS[state], state});\n";
+    outFile << "    }\n";
+    outFile << "    sort(hits.rbegin(), hits.rend());\n";
+    outFile << "    cout << \"state hits (top 20):\" << endl;\n";
+    outFile << "    for (size_t i = 0; i < hits.size() && i < 20; i++) {\n";
+    outFile << "        cout << \"  state \" << hits[i].second << (hits[i].second == DEAD_STATE ? \" (dead)\" : \"\")\n";
+    outFile << "             << \" \" << hits[i].first << endl;\n";
+    outFile << "    }\n";
+    outFile << "#endif\n";
+    outFile << "    return errors ? 1 : 0;\n";
+    outFile << "}\n";
+    
+    outFile << "\nint main(int argc, char* argv[]) {\n";
+    outFile << "    LexicalAnalyzer analyzer;\n";
+    outFile << "    string mode;\n";
+    outFile << "    int runs = 0;\n";
+    outFile << "    const char* path = nullptr;\n";
+    outFile << "    for (int i = 1; i < argc; i++) {\n";
+    outFile << "        string arg = argv[i];\n";
+    outFile << "        if (arg == \"--bench\" && i + 1 < argc) {\n";
+    outFile << "            mode = arg;\n";
+    outFile << "            runs = max(1, atoi(argv[++i]));\n";
+    outFile << "        } else if (arg == \"--stats\") {\n";
+    outFile << "            mode = arg;\n";
+    outFile << "        } else if (!arg.empty() && arg[0] != '-' && !path) {\n";
+    outFile << "            path = argv[i];\n";
+    outFile << "        } else {\n";
+    outFile << "            cerr << \"Usage: \" << argv[0] << \" [--bench N | --stats] [FILE]\" << endl;\n";
+    outFile << "            return 2;\n";
+    outFile << "        }\n";
+    outFile << "    }\n";
+    outFile << "    \n    if (mode.empty() && !path) {\n";
+    outFile << "        cout << \"Enter input to tokenize (Ctrl+D to end):\" << endl;\n";
+    outFile << "    }\n";
+    outFile << "    string input;\n";
+    outFile << "    if (!readInput(path, input)) {\n";
+    outFile << "        return 1;\n";
+    outFile << "    }\n";
+    outFile << "    if (mode == \"--bench\") {\n";
+    outFile << "        return bench(analyzer, input, runs);\n";
+    outFile << "    }\n";
+    outFile << "    if (mode == \"--stats\") {\n";
+    outFile << "        return stats(analyzer, input);\n";
+    outFile << "    }\n";
+    outFile << "    \n    vector<Token> tokens = analyzer.tokenize(input);\n";
+    outFile << "    \n    cout << \"\\n========== TOKENS ==========\" << endl;\n";
+    outFile << "    for (const auto& token : tokens) {\n";
+    outFile << "        cout << \"<\" << token.type << \", \" << token.lexeme << \">\" << endl;\n";
+    outFile << "    }\n";
+    outFile << "    \n    return 0;\n";
+    outFile << "}\n";
+    
+    if (!outFile.close()) {
+        cerr << "Error: Could not write file " << filename << endl;
+        return false;
+    }
+    emitted.bytes += outFile.bytesWritten();
+    
+    // Table chunks: data only, one translation unit each
+    for (size_t chunk = 0; chunk < chunkCount && split; chunk++) {
+        BufferedWriter chunkFile(chunkFiles[chunk]);
+        if (!chunkFile.isOpen()) {
+            cerr << "Error: Could not open file " << chunkFiles[chunk] << " for writing." << endl;
+            return false;
+        }
+        
+        size_t firstRow = chunk * rowsPerChunk;
+        size_t lastRow = min<size_t>(firstRow + rowsPerChunk, table.stateCount);
+        vector<int> rows(table.next.begin() + firstRow * table.classCount,
+                         table.next.begin() + lastRow * table.classCount);
+        
+        chunkFile << "// Auto-generated transition table rows " << firstRow << "-" << (lastRow - 1)
+                  << " for " << filename << "\n";
+        chunkFile << "extern const int " << prefix << "_transitions_" << chunk << "[] = {";
+        writeIntArray(chunkFile, rows, table.classCount);
+        chunkFile << "};\n";
+        
+        if (!chunkFile.close()) {
+            cerr << "Error: Could not write file " << chunkFiles[chunk] << endl;
+            return false;
+        }
+        emitted.bytes += chunkFile.bytesWritten();
+        emitted.files.push_back(chunkFiles[chunk]);
+    }
+    
+    emitted.milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+    if (report) {
+        *report = emitted;
+    }
+    return true;
+}
+
+bool DFA::generateCApiCode(const string& basePath, EmitReport* report, const EmitLayout& layout) const {
+    TraceScope trace("emit", "emit capi", basePath);
+    auto started = chrono::steady_clock::now();
+    string headerFile = basePath + ".h";
+    string sourceFile = basePath + ".cpp";
+    string prefix = identifierFrom(stemOf(basePath));
+    string guard = prefix;
+    transform(guard.begin(), guard.end(), guard.begin(), ::toupper);
+    
+    EmitReport emitted;
+    FlatTable table = buildFlatTable();
+    vector<string> tokenNames;
+    vector<int> tokenKind = tokenKinds(table.stateCount, tokenNames);
+    
+    // ---------- Header: the stable C interface ----------
+    BufferedWriter header(headerFile);
+    if (!header.isOpen()) {
+        cerr << "Error: Could not open file " << headerFile << " for writing." << endl;
+        return false;
+    }
+    
+    header << "/* Auto-generated Lexical Analyzer - C interface */\n";
+    header << "#ifndef " << guard << "_H\n";
+    header << "#define " << guard << "_H\n";
+    header << "\n#include <stddef.h>\n";
+    header << "#include <stdint.h>\n";
+    header << "\n#if defined(_WIN32)\n";
+    header << "#define " << guard << "_API __declspec(dllexport)\n";
+    header << "#else\n";
+    header << "#define " << guard << "_API __attribute__((visibility(\"default\")))\n";
+    header << "#endif\n";
+    header << "\n#ifdef __cplusplus\n";
+    header << "extern \"C\" {\n";
+    header << "#endif\n";
+    header << "\n/* Token kinds */\n";
+    vector<string> kindMacros = tokenKindMacros(guard, tokenNames);
+    for (size_t i = 0; i < tokenNames.size(); i++) {
+        header << "#define " << kindMacros[i] << " " << i << "\n";
+    }
+    header << "\n/* A token refers back into the caller's input; nothing is copied */\n";
+    header << "typedef struct " << prefix << "_token {\n";
+    header << "    int32_t kind;      /* index for " << prefix << "_token_name() */\n";
+    header << "    uint32_t line;     /* 1-based */\n";
+    header << "    uint32_t column;   /* 1-based */\n";
+    header << "    size_t offset;     /* byte offset of the lexeme in the input */\n";
+    header << "    size_t length;     /* lexeme length in bytes */\n";
+    header << "} " << prefix << "_token;\n";
+    header << "\ntypedef struct " << prefix << "_lexer " << prefix << "_lexer;\n";
+    header << "\n" << guard << "_API " << prefix << "_lexer* " << prefix << "_create(void);\n";
+    header << guard << "_API void " << prefix << "_destroy(" << prefix << "_lexer* lexer);\n";
+    header << "\n/* Tokenize input into out[0..capacity). Returns the total number of tokens,\n";
+    header << "   which may exceed capacity; call again with a larger buffer in that case. */\n";
+    header << guard << "_API size_t " << prefix << "_tokenize(" << prefix << "_lexer* lexer, const char* input, size_t length,\n";
+    header << "        " << prefix << "_token* out, size_t capacity);\n";
+    header << "\n/* Tokenize into the lexer's own buffer. The array stays valid until the next\n";
+    header << "   call on the same lexer. */\n";
+    header << guard << "_API const " << prefix << "_token* " << prefix << "_tokenize_all(" << prefix << "_lexer* lexer,\n";
+    header << "        const char* input, size_t length, size_t* count);\n";
+    header << "\n/* Characters skipped as lexical errors by the last tokenize call */\n";
+    header << guard << "_API size_t " << prefix << "_error_count(const " << prefix << "_lexer* lexer);\n";
+    header << "\n" << guard << "_API const char* " << prefix << "_token_name(int32_t kind);\n";
+    header << guard << "_API int32_t " << prefix << "_token_kind_count(void);\n";
+    header << "\n#ifdef __cplusplus\n";
+    header << "}\n";
+    header << "#endif\n";
+    header << "\n#endif /* " << guard << "_H */\n";
+    
+    if (!header.close()) {
+        cerr << "Error: Could not write file " << headerFile << endl;
+        return false;
+    }
+    emitted.files.push_back(headerFile);
+    emitted.bytes += header.bytesWritten();
+    
+    // ---------- Source: tables and scanner behind the C interface ----------
+    BufferedWriter source(sourceFile);
+    if (!source.isOpen()) {
+        cerr << "Error: Could not open file " << sourceFile << " for writing." << endl;
+        return false;
+    }
+    
+    source << "// Auto-generated Lexical Analyzer - shared library implementation\n";
+    source << "// Build: g++ -O2 -shared -fPIC -fvisibility=hidden -o lib" << prefix << ".so " << stemOf(sourceFile) << ".cpp\n";
+    source << "\n#include \"" << stemOf(headerFile) << ".h\"\n";
+    source << "#include <vector>\n";
+    source << "#include <new>\n";
+    source << "\nnamespace {\n";
+    emitted.tableBytes = writeTableData(source, table, startState, tokenKind, tokenNames, layout.compactTypes);
+    if (static_cast<int>(layout.directStates.size()) < table.deadState) {
+        string cellType = layout.compactTypes ? smallestIntType(0, table.stateCount - 1) : "int";
+        emitted.tableBytes += table.next.size() * cTypeBytes(cellType);
+        source << "\n// Transition table rows (state * NUM_CLASSES + column); DEAD_STATE = no match\n";
+        source << "static const " << cellType << " TRANSITIONS[NUM_STATES * NUM_CLASSES] = {";
+        writeIntArray(source, table.next, table.classCount);
+        source << "};\n";
+    }
+    
+    source << "\n// Longest match, earliest rule on ties; calls emit(token) per token\n";
+    source << "template <typename Emit>\n";
+    source << "size_t scan(const char* input, size_t length, Emit emit) {\n";
+    source << "    size_t errors = 0;\n";
+    source << "    size_t pos = 0;\n";
+    source << "    uint32_t line = 1, column = 1;\n";
+    source << "    while (pos < length) {\n";
+    source << "        int lastAcceptState = -1;\n";
+    source << "        size_t lastAcceptEnd = pos;\n";
+    writeMatchBlock(source, table, tokenKind, startState, layout.directStates);
+    source << "        size_t end = lastAcceptEnd;\n";
+    source << "        if (lastAcceptState != -1) {\n";
+    source << "            " << prefix << "_token token;\n";
+    source << "            token.kind = TOKEN_KIND[lastAcceptState];\n";
+    source << "            token.line = line;\n";
+    source << "            token.column = column;\n";
+    source << "            token.offset = pos;\n";
+    source << "            token.length = end - pos;\n";
+    source << "            emit(token);\n";
+    source << "        } else {\n";
+    source << "            char c = input[pos];\n";
+    source << "            if (c != ' ' && c != '\\t' && c != '\\n') errors++;\n";
+    source << "            end = pos + 1;\n";
+    source << "        }\n";
+    source << "        for (; pos < end; pos++) {\n";
+    source << "            if (input[pos] == '\\n') {\n";
+    source << "                line++;\n";
+    source << "                column = 1;\n";
+    source << "            } else {\n";
+    source << "                column++;\n";
+    source << "            }\n";
+    source << "        }\n";
+    source << "    }\n";
+    source << "    return errors;\n";
+    source << "}\n";
+    source << "\n} // namespace\n";
+    
+    source << "\nstruct " << prefix << "_lexer {\n";
+    source << "    std::vector<" << prefix << "_token> tokens;\n";
+    source << "    size_t errors;\n";
+    source << "};\n";
+    
+    source << "\nextern \"C\" {\n";
+    source << "\n" << prefix << "_lexer* " << prefix << "_create(void) {\n";
+    source << "    " << prefix << "_lexer* lexer = new (std::nothrow) " << prefix << "_lexer();\n";
+    source << "    if (lexer) lexer->errors = 0;\n";
+    source << "    return lexer;\n";
+    source << "}\n";
+    source << "\nvoid " << prefix << "_destroy(" << prefix << "_lexer* lexer) {\n";
+    source << "    delete lexer;\n";
+    source << "}\n";
+    source << "\nsize_t " << prefix << "_tokenize(" << prefix << "_lexer* lexer, const char* input, size_t length,\n";
+    source << "        " << prefix << "_token* out, size_t capacity) {\n";
+    source << "    size_t count = 0;\n";
+    source << "    size_t errors = scan(input, length, [&](const " << prefix << "_token& token) {\n";
+    source << "        if (count < capacity) out[count] = token;\n";
+    source << "        count++;\n";
+    source << "    });\n";
+    source << "    if (lexer) lexer->errors = errors;\n";
+    source << "    return count;\n";
+    source << "}\n";
+    source << "\nconst " << prefix << "_token* " << prefix << "_tokenize_all(" << prefix << "_lexer* lexer,\n";
+    source << "        const char* input, size_t length, size_t* count) {\n";
+    source << "    if (!lexer) {\n";
+    source << "        if (count) *count = 0;\n";
+    source << "        return NULL;\n";
+    source << "    }\n";
+    source << "    lexer->tokens.clear();\n";
+    source << "    try {\n";
+    source << "        lexer->errors = scan(input, length, [&](const " << prefix << "_token& token) {\n";
+    source << "            lexer->tokens.push_back(token);\n";
+    source << "        });\n";
+    source << "    } catch (...) {\n";
+    source << "        // Out of memory: report what was collected\n";
+    source << "    }\n";
+    source << "    if (count) *count = lexer->tokens.size();\n";
+    source << "    return lexer->tokens.data();\n";
+    source << "}\n";
+    source << "\nsize_t " << prefix << "_error_count(const " << prefix << "_lexer* lexer) {\n";
+    source << "    return lexer ? lexer->errors : 0;\n";
+    source << "}\n";
+    source << "\nconst char* " << prefix << "_token_name(int32_t kind) {\n";
+    source << "    return (kind >= 0 && kind < NUM_TOKEN_KINDS) ? TOKEN_NAMES[kind] : \"\";\n";
+    source << "}\n";
+    source << "\nint32_t " << prefix << "_token_kind_count(void) {\n";
+    source << "    return NUM_TOKEN_KINDS;\n";
+    source << "}\n";
+    source << "\n} // extern \"C\"\n";
+    
+    if (!source.close()) {
+        cerr << "Error: Could not write file " << sourceFile << endl;
+        return false;
+    }
+    emitted.files.push_back(sourceFile);
+    emitted.bytes += source.bytesWritten();
+    
+    emitted.milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+    if (report) {
+        *report = emitted;
+    }
+    return true;
+}
+
+bool DFA::generateCCode(const string& basePath, EmitReport* report) const {
+    TraceScope trace("emit", "emit c", basePath);
+    auto started = chrono::steady_clock::now();
+    string headerFile = basePath + ".h";
+    string sourceFile = basePath + ".c";
+    string prefix = identifierFrom(stemOf(basePath));
+    string guard = prefix;
+    transform(guard.begin(), guard.end(), guard.begin(), ::toupper);
+    
+    EmitReport emitted;
+    FlatTable table = buildFlatTable();
+    vector<string> tokenNames;
+    vector<int> tokenKind = tokenKinds(table.stateCount, tokenNames);
+    
+    // ---------- Header ----------
+    BufferedWriter header(headerFile);
+    if (!header.isOpen()) {
+        cerr << "Error: Could not open file " << headerFile << " for writing." << endl;
+        return false;
+    }
+    
+    header << "/* Auto-generated Lexical Analyzer - freestanding C99 */\n";
+    header << "#ifndef " << guard << "_H\n";
+    header << "#define " << guard << "_H\n";
+    header << "\n#include <stddef.h>\n";
+    header << "#include <stdint.h>\n";
+    header << "\n#ifdef __cplusplus\n";
+    header << "extern \"C\" {\n";
+    header << "#endif\n";
+    header << "\n/* Token kinds */\n";
+    vector<string> kindMacros = tokenKindMacros(guard, tokenNames);
+    for (size_t i = 0; i < tokenNames.size(); i++) {
+        header << "#define " << kindMacros[i] << " " << i << "\n";
+    }
+    header << "\ntypedef struct " << prefix << "_token {\n";
+    header << "    int32_t kind;\n";
+    header << "    uint32_t line;\n";
+    header << "    uint32_t column;\n";
+    header << "    size_t offset;\n";
+    header << "    size_t length;\n";
+    header << "} " << prefix << "_token;\n";
+    header << "\n/* Tokenize input into out[0..capacity) without allocating. Returns the total\n";
+    header << "   number of tokens, which may exceed capacity. If errors is not NULL it\n";
+    header << "   receives the number of characters skipped as lexical errors. */\n";
+    header << "size_t " << prefix << "_tokenize(const char* input, size_t length,\n";
+    header << "        " << prefix << "_token* out, size_t capacity, size_t* errors);\n";
+    header << "\nconst char* " << prefix << "_token_name(int32_t kind);\n";
+    header << "\n#ifdef __cplusplus\n";
+    header << "}\n";
+    header << "#endif\n";
+    header << "\n#endif /* " << guard << "_H */\n";
+    
+    if (!header.close()) {
+        cerr << "Error: Could not write file " << headerFile << endl;
+        return false;
+    }
+    emitted.files.push_back(headerFile);
+    emitted.bytes += header.bytesWritten();
+    
+    // ---------- Source ----------
+    BufferedWriter source(sourceFile);
+    if (!source.isOpen()) {
+        cerr << "Error: Could not open file " << sourceFile << " for writing." << endl;
+        return false;
+    }
+    
+    string stateType = smallestIntType(0, table.stateCount - 1);
+    source << "/* Auto-generated Lexical Analyzer - freestanding C99, no heap, no libc calls.\n";
+    source << "   Build: cc -std=c99 -Os -c " << stemOf(sourceFile) << ".c\n";
+    source << "   Define " << guard << "_MAIN to get a small driver: [FILE] prints tokens (default\n";
+    source << "   stdin), --bench N FILE reports throughput, --stats FILE a token-kind\n";
+    source << "   histogram; also define " << guard << "_STATE_COUNTERS for per-state hit counts. */\n";
+    source << "\n#include \"" << stemOf(headerFile) << ".h\"\n";
+    emitted.tableBytes = writeTableData(source, table, startState, tokenKind, tokenNames, true) +
+                         table.next.size() * cTypeBytes(stateType);
+    source << "\n/* Transition table rows (state * NUM_CLASSES + column); DEAD_STATE = no match */\n";
+    source << "static const " << stateType << " TRANSITIONS[NUM_STATES * NUM_CLASSES] = {";
+    writeIntArray(source, table.next, table.classCount);
+    source << "};\n";
+    source << "\n#ifdef " << guard << "_STATE_COUNTERS\n";
+    source << "/* Times each state was entered */\n";
+    source << "static uint64_t STATE_HITS[NUM_STATES];\n";
+    source << "#endif\n";
+    
+    source << "\n/* With consumed set, stops as soon as out is full and stores how many bytes\n";
+    source << "   were scanned, so the caller can resume there without rescanning */\n";
+    source << "static size_t scan(const char* input, size_t length, " << prefix << "_token* out,\n";
+    source << "        size_t capacity, size_t* errors, size_t* consumed) {\n";
+    source << "    size_t count = 0, skipped = 0, pos = 0;\n";
+    source << "    uint32_t line = 1, column = 1;\n";
+    source << "    while (pos < length && !(consumed && count == capacity)) {\n";
+    source << "        int state = START_STATE;\n";
+    source << "        int lastAcceptState = -1;\n";
+    source << "        size_t lastAcceptEnd = pos, end, i;\n";
+    source << "        for (i = pos; i < length; i++) {\n";
+    source << "            state = TRANSITIONS[state * NUM_CLASSES + BYTE_CLASS[(unsigned char)input[i]]];\n";
+    source << "#ifdef " << guard << "_STATE_COUNTERS\n";
+    source << "            STATE_HITS[state]++;\n";
+    source << "#endif\n";
+    source << "            if (state == DEAD_STATE) break;\n";
+    source << "            if (TOKEN_KIND[state] != -1) {\n";
+    source << "                lastAcceptState = state;\n";
+    source << "                lastAcceptEnd = i + 1;\n";
+    source << "            }\n";
+    source << "        }\n";
+    source << "        end = lastAcceptEnd;\n";
+    source << "        if (lastAcceptState != -1) {\n";
+    source << "            if (count < capacity) {\n";
+    source << "                out[count].kind = TOKEN_KIND[lastAcceptState];\n";
+    source << "                out[count].line = line;\n";
+    source << "                out[count].column = column;\n";
+    source << "                out[count].offset = pos;\n";
+    source << "                out[count].length = end - pos;\n";
+    source << "            }\n";
+    source << "            count++;\n";
+    source << "        } else {\n";
+    source << "            char c = input[pos];\n";
+    source << "            if (c != ' ' && c != '\\t' && c != '\\n') skipped++;\n";
+    source << "            end = pos + 1;\n";
+    source << "        }\n";
+    source << "        for (; pos < end; pos++) {\n";
+    source << "            if (input[pos] == '\\n') {\n";
+    source << "                line++;\n";
+    source << "                column = 1;\n";
+    source << "            } else {\n";
+    source << "                column++;\n";
+    source << "            }\n";
+    source << "        }\n";
+    source << "    }\n";
+    source << "    if (errors) *errors = skipped;\n";
+    source << "    if (consumed) *consumed = pos;\n";
+    source << "    return count;\n";
+    source << "}\n";
+    source << "\nsize_t " << prefix << "_tokenize(const char* input, size_t length,\n";
+    source << "        " << prefix << "_token* out, size_t capacity, size_t* errors) {\n";
+    source << "    return scan(input, length, out, capacity, errors, NULL);\n";
+    source << "}\n";
+    source << "\nconst char* " << prefix << "_token_name(int32_t kind) {\n";
+    source << "    return (kind >= 0 && kind < NUM_TOKEN_KINDS) ? TOKEN_NAMES[kind] : \"\";\n";
+    source << "}\n";
+    
+    // Optional hosted driver; static buffers keep it allocation-free
+    source << "\n#ifdef " << guard << "_MAIN\n";
+    source << "#include <stdio.h>\n";
+    source << "#include <stdlib.h>\n";
+    source << "#include <string.h>\n";
+    source << "#include <time.h>\n";
+    source << "\n#ifndef " << guard << "_MAX_INPUT\n";
+    source << "#define " << guard << "_MAX_INPUT (1 << 20)\n";
+    source << "#endif\n";
+    source << "#ifndef " << guard << "_MAX_TOKENS\n";
+    source << "#define " << guard << "_MAX_TOKENS (1 << 16)\n";
+    source << "#endif\n";
+    source << "\nstatic char input[" << guard << "_MAX_INPUT];\n";
+    source << "static " << prefix << "_token tokens[" << guard << "_MAX_TOKENS];\n";
+    
+    source << "\n/* Lex the input runs times after one warmup run; clock() is CPU time */\n";
+    source << "static int bench(size_t length, int runs) {\n";
+    source << "    size_t errors = 0;\n";
+    source << "    size_t count = " << prefix << "_tokenize(input, length, tokens, " << guard << "_MAX_TOKENS, &errors);\n";
+    source << "    clock_t start = clock();\n";
+    source << "    double seconds;\n";
+    source << "    int run;\n";
+    source << "    for (run = 0; run < runs; run++) {\n";
+    source << "        count = " << prefix << "_tokenize(input, length, tokens, " << guard << "_MAX_TOKENS, &errors);\n";
+    source << "    }\n";
+    source << "    seconds = (double)(clock() - start) / CLOCKS_PER_SEC;\n";
+    source << "    printf(\"%d runs over %lu bytes, %lu tokens, %lu errors\\n\", runs, (unsigned long)length,\n";
+    source << "           (unsigned long)count, (unsigned long)errors);\n";
+    source << "    if (seconds <= 0) {\n";
+    source << "        printf(\"too fast to measure; raise N\\n\");\n";
+    source << "        return 0;\n";
+    source << "    }\n";
+    source << "    printf(\"mean: %.2f MB/s, %.2f Mtokens/s\\n\", length / 1e6 * runs / seconds, count / 1e6 * runs / seconds);\n";
+    source << "    return 0;\n";
+    source << "}\n";
+    
+    source << "\n/* Bytes, token and error counts, then tokens per kind. Each scan stops when\n";
+    source << "   the token buffer is full and the next one resumes there, so every byte\n";
+    source << "   (and every state hit) is counted once */\n";
+    source << "static int stats(size_t length) {\n";
+    source << "    size_t histogram[NUM_TOKEN_KINDS];\n";
+    source << "    size_t errors = 0, count = 0, offset = 0, stored, skipped, consumed, i;\n";
+    source << "    memset(histogram, 0, sizeof(histogram));\n";
+    source << "    while (offset < length) {\n";
+    source << "        stored = scan(input + offset, length - offset, tokens, " << guard
+           << "_MAX_TOKENS, &skipped, &consumed);\n";
+    source << "        for (i = 0; i < stored; i++) histogram[tokens[i].kind]++;\n";
+    source << "        count += stored;\n";
+    source << "        errors += skipped;\n";
+    source << "        offset += consumed;\n";
+    source << "    }\n";
+    source << "    printf(\"bytes:  %lu\\n\", (unsigned long)length);\n";
+    source << "    printf(\"tokens: %lu\\n\", (unsigned long)count);\n";
+    source << "    printf(\"errors: %lu\\n\", (unsigned long)errors);\n";
+    source << "    for (i = 0; i < NUM_TOKEN_KINDS; i++) {\n";
+    source << "        if (histogram[i]) {\n";
+    source << "            printf(\"  %s %lu (%.2f%%)\\n\", " << prefix << "_token_name((int32_t)i),\n";
+    source << "                   (unsigned long)histogram[i], 100.0 * histogram[i] / count);\n";
+    source << "        }\n";
+    source << "    }\n";
+    source << "#ifdef " << guard << "_STATE_COUNTERS\n";
+    source << "    printf(\"state hits:\\n\");\n";
+    source << "    for (i = 0; i < NUM_STATES; i++) {\n";
+    source << "        if (STATE_HITS[i]) {\n";
+    source << "            printf(\"  state %lu%s %llu\\n\", (unsigned long)i, i == DEAD_STATE ? \" (dead)\" : \"\",\n";
+    source << "                   (unsigned long long)STATE_HITS[i]);\n";
+    source << "        }\n";
+    source << "    }\n";
+    source << "#endif\n";
+    source << "    return errors ? 1 : 0;\n";
+    source << "}\n";
+    
+    source << "\nint main(int argc, char** argv) {\n";
+    source << "    const char* path = NULL;\n";
+    source << "    int runs = 0, statsMode = 0, i;\n";
+    source << "    FILE* in = stdin;\n";
+    source << "    size_t length, errors = 0, count, offset = 0, skipped, consumed;\n";
+    source << "    for (i = 1; i < argc; i++) {\n";
+    source << "        if (strcmp(argv[i], \"--bench\") == 0 && i + 1 < argc) {\n";
+    source << "            runs = atoi(argv[++i]);\n";
+    source << "            if (runs < 1) runs = 1;\n";
+    source << "        } else if (strcmp(argv[i], \"--stats\") == 0) {\n";
+    source << "            statsMode = 1;\n";
+    source << "        } else if (argv[i][0] != '-' && !path) {\n";
+    source << "            path = argv[i];\n";
+    source << "        } else {\n";
+    source << "            fprintf(stderr, \"Usage: %s [--bench N | --stats] [FILE]\\n\", argv[0]);\n";
+    source << "            return 2;\n";
+    source << "        }\n";
+    source << "    }\n";
+    source << "    if (path && !(in = fopen(path, \"rb\"))) {\n";
+    source << "        fprintf(stderr, \"Cannot read %s\\n\", path);\n";
+    source << "        return 1;\n";
+    source << "    }\n";
+    source << "    length = fread(input, 1, sizeof(input), in);\n";
+    source << "    if (length == sizeof(input)) {\n";
+    source << "        fprintf(stderr, \"Input truncated to %lu bytes (" << guard << "_MAX_INPUT)\\n\", (unsigned long)length);\n";
+    source << "    }\n";
+    source << "    if (path) fclose(in);\n";
+    source << "    if (runs) return bench(length, runs);\n";
+    source << "    if (statsMode) return stats(length);\n";
+    source << "    \n";
+    source << "    /* Print a buffer of tokens at a time, resuming where the last scan stopped */\n";
+    source << "    while (offset < length) {\n";
+    source << "        count = scan(input + offset, length - offset, tokens, " << guard
+           << "_MAX_TOKENS, &skipped, &consumed);\n";
+    source << "        for (i = 0; (size_t)i < count; i++) {\n";
+    source << "            printf(\"<%s, %.*s>\\n\", " << prefix << "_token_name(tokens[i].kind),\n";
+    source << "                   (int)tokens[i].length, input + offset + tokens[i].offset);\n";
+    source << "        }\n";
+    source << "        errors += skipped;\n";
+    source << "        offset += consumed;\n";
+    source << "    }\n";
+    source << "    if (errors) fprintf(stderr, \"%lu lexical error(s)\\n\", (unsigned long)errors);\n";
+    source << "    return errors ? 1 : 0;\n";
+    source << "}\n";
+    source << "#endif\n";
+    
+    if (!source.close()) {
+        cerr << "Error: Could not write file " << sourceFile << endl;
+        return false;
+    }
+    emitted.files.push_back(sourceFile);
+    emitted.bytes += source.bytesWritten();
+    
+    emitted.milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+    if (report) {
+        *report = emitted;
+    }
+    return true;
+}
+
+// ==================== Scanner Implementation ====================
+
+Scanner::Scanner(const DFA& dfa) : table(dfa.buildFlatTable()), startState(dfa.getStartState()) {
+    tokenKind = dfa.tokenKinds(table.stateCount, tokenNames);
+}
+
+size_t Scanner::tokenize(const char* input, size_t length, vector<ScanToken>& tokens) const {
+    const int* next = table.next.data();
+    const int* byteClass = table.byteClass.data();
+    const int* kinds = tokenKind.data();
+    int classCount = table.classCount;
+    int deadState = table.deadState;
+    
+    tokens.clear();
+    if (table.stateCount == 0) {
+        return 0;
+    }
+    
+    size_t errors = 0;
+    size_t pos = 0;
+    uint32_t line = 1, column = 1;
+    
+    while (pos < length) {
+        int state = startState;
+        int lastAcceptState = -1;
+        size_t lastAcceptEnd = pos;
+        
+        for (size_t i = pos; i < length; i++) {
+            state = next[state * classCount + byteClass[static_cast<unsigned char>(input[i])]];
+            if (state == deadState) break;
+            if (kinds[state] != -1) {
+                lastAcceptState = state;
+                lastAcceptEnd = i + 1;
+            }
+        }
+        
+        size_t end = lastAcceptEnd;
+        if (lastAcceptState != -1) {
+            ScanToken token;
+            token.kind = kinds[lastAcceptState];
+            token.line = line;
+            token.column = column;
+            token.offset = pos;
+            token.length = end - pos;
+            tokens.push_back(token);
+        } else {
+            char c = input[pos];
+            if (c != ' ' && c != '\t' && c != '\n') errors++;
+            end = pos + 1;
+        }
+        
+        for (; pos < end; pos++) {
+            if (input[pos] == '\n') {
+                line++;
+                column = 1;
+            } else {
+                column++;
+            }
+        }
+    }
+    
+    return errors;
+}
+
+size_t Scanner::profile(const char* input, size_t length, StateProfile& profile) const {
+    const int* next = table.next.data();
+    const int* byteClass = table.byteClass.data();
+    const int* kinds = tokenKind.data();
+    int classCount = table.classCount;
+    int deadState = table.deadState;
+    
+    if (profile.stateVisits.size() < static_cast<size_t>(table.stateCount)) {
+        profile.stateVisits.resize(table.stateCount, 0);
+    }
+    if (table.stateCount == 0) {
+        return 0;
+    }
+    
+    // Transition counts per table cell first; folded into (from, to) pairs at the end
+    vector<uint64_t> cellVisits(table.next.size(), 0);
+    size_t errors = 0;
+    size_t pos = 0;
+    
+    while (pos < length) {
+        int state = startState;
+        int lastAcceptState = -1;
+        size_t lastAcceptEnd = pos;
+        profile.stateVisits[state]++;
+        
+        for (size_t i = pos; i < length; i++) {
+            size_t cell = static_cast<size_t>(state) * classCount + byteClass[static_cast<unsigned char>(input[i])];
+            state = next[cell];
+            if (state == deadState) break;
+            cellVisits[cell]++;
+            profile.stateVisits[state]++;
+            if (kinds[state] != -1) {
+                lastAcceptState = state;
+                lastAcceptEnd = i + 1;
+            }
+        }
+        
+        if (lastAcceptState != -1) {
+            pos = lastAcceptEnd;
+        } else {
+            char c = input[pos];
+            if (c != ' ' && c != '\t' && c != '\n') errors++;
+            pos++;
+        }
+    }
+    
+    for (size_t cell = 0; cell < cellVisits.size(); cell++) {
+        if (cellVisits[cell]) {
+            int from = static_cast<int>(cell / classCount);
+            profile.transitionVisits[{from, next[cell]}] += cellVisits[cell];
+        }
+    }
+    
+    return errors;
+}
+
+// ==================== NFAScanner Implementation ====================
+
+NFAScanner::NFAScanner(const NFA& nfa, const vector<string>& ruleNames, const vector<string>& tokenNames)
+    : nfa(nfa), ruleKind(ruleNames.size(), -1) {
+    for (size_t rule = 0; rule < ruleNames.size(); rule++) {
+        auto found = find(tokenNames.begin(), tokenNames.end(), ruleNames[rule]);
+        if (found != tokenNames.end()) {
+            ruleKind[rule] = static_cast<int>(found - tokenNames.begin());
+        }
+    }
+}
+
+size_t NFAScanner::tokenize(const char* input, size_t length, vector<ScanToken>& tokens) const {
+    const map<int, int>& acceptRules = nfa.getAcceptRules();
+    set<int> start = nfa.epsilonClosure(nfa.getStartState());
+    
+    tokens.clear();
+    size_t errors = 0;
+    size_t pos = 0;
+    uint32_t line = 1, column = 1;
+    
+    while (pos < length) {
+        set<int> current = start;
+        int lastAcceptRule = -1;
+        size_t lastAcceptEnd = pos;
+        
+        for (size_t i = pos; i < length; i++) {
+            // '\0' labels epsilon edges in the NFA, so a NUL byte never matches
+            if (input[i] == '\0') break;
+            current = nfa.epsilonClosure(nfa.move(current, input[i]));
+            if (current.empty()) break;
+            
+            int rule = -1;
+            for (int state : current) {
+                auto tag = acceptRules.find(state);
+                if (tag != acceptRules.end() && (rule == -1 || tag->second < rule)) {
+                    rule = tag->second;
+                }
+            }
+            if (rule != -1) {
+                lastAcceptRule = rule;
+                lastAcceptEnd = i + 1;
+            }
+        }
+        
+        size_t end = lastAcceptEnd;
+        if (lastAcceptRule != -1) {
+            ScanToken token;
+            token.kind = lastAcceptRule < static_cast<int>(ruleKind.size()) ? ruleKind[lastAcceptRule] : -1;
+            token.line = line;
+            token.column = column;
+            token.offset = pos;
+            token.length = end - pos;
+            tokens.push_back(token);
+        } else {
+            char c = input[pos];
+            if (c != ' ' && c != '\t' && c != '\n') errors++;
+            end = pos + 1;
+        }
+        
+        for (; pos < end; pos++) {
+            if (input[pos] == '\n') {
+                line++;
+                column = 1;
+            } else {
+                column++;
+            }
+        }
+    }
+    
+    return errors;
+}
+
+// ==================== CorpusGenerator Implementation ====================
+
+CorpusGenerator::CorpusGenerator(const DFA& dfa) : startState(dfa.getStartState()) {
+    int stateCount = 0;
+    for (const auto& state : dfa.getStates()) {
+        stateCount = max(stateCount, state.id + 1);
+    }
+    stateKind = dfa.tokenKinds(stateCount, kindNames);
+    
+    successors.resize(stateCount);
+    vector<vector<int>> predecessors(stateCount);
+    for (const auto& trans : dfa.getTransitions()) {
+        successors[trans.first.first].push_back({trans.first.second, trans.second});
+        predecessors[trans.second].push_back(trans.first.first);
+    }
+    
+    // Backward breadth-first search from the states each kind wins
+    distance.assign(kindNames.size(), vector<int>(stateCount, -1));
+    for (size_t kind = 0; kind < kindNames.size(); kind++) {
+        vector<int>& steps = distance[kind];
+        queue<int> pending;
+        for (int state = 0; state < stateCount; state++) {
+            if (stateKind[state] == static_cast<int>(kind)) {
+                steps[state] = 0;
+                pending.push(state);
+            }
+        }
+        while (!pending.empty()) {
+            int current = pending.front();
+            pending.pop();
+            for (int previous : predecessors[current]) {
+                if (steps[previous] == -1) {
+                    steps[previous] = steps[current] + 1;
+                    pending.push(previous);
+                }
+            }
+        }
+    }
+    
+    // A kind is producible if some byte out of the start state still leads to it
+    kindWeights.assign(kindNames.size(), 0);
+    for (size_t kind = 0; kind < kindNames.size() && stateCount > 0; kind++) {
+        for (const auto& edge : successors[startState]) {
+            if (distance[kind][edge.second] != -1) {
+                kindWeights[kind] = 1;
+                break;
+            }
+        }
+    }
+}
+
+bool CorpusGenerator::setWeights(const map<string, double>& weights) {
+    vector<double> updated(kindNames.size(), 0);
+    for (const auto& weight : weights) {
+        auto found = find(kindNames.begin(), kindNames.end(), weight.first);
+        if (found == kindNames.end()) {
+            cerr << "Error: unknown token kind " << weight.first << endl;
+            return false;
+        }
+        size_t kind = found - kindNames.begin();
+        if (kindWeights[kind] == 0 && weight.second > 0) {
+            cerr << "Error: token kind " << weight.first << " can never be produced" << endl;
+            return false;
+        }
+        updated[kind] = max(0.0, weight.second);
+    }
+    kindWeights = updated;
+    return true;
+}
+
+size_t CorpusGenerator::generate(uint64_t bytes, uint64_t seed, ostream& out) const {
+    double totalWeight = 0;
+    for (double weight : kindWeights) {
+        totalWeight += weight;
+    }
+    if (totalWeight <= 0 || bytes == 0) {
+        return 0;
+    }
+    
+    mt19937_64 random(seed);
+    auto uniform = [&random]() { return (random() >> 11) * (1.0 / 9007199254740992.0); };  // [0, 1)
+    
+    string buffer;
+    buffer.reserve((1 << 20) + 4096);
+    vector<pair<char, int>> candidates;
+    uint64_t written = 0;
+    size_t tokens = 0;
+    
+    while (written + buffer.size() < bytes) {
+        // Pick the kind, then walk toward it
+        double pick = uniform() * totalWeight;
+        size_t kind = 0;
+        for (size_t candidate = 0; candidate < kindWeights.size(); candidate++) {
+            if (kindWeights[candidate] <= 0) continue;
+            kind = candidate;  // rounding can leave pick just past the last weight
+            if (pick < kindWeights[candidate]) break;
+            pick -= kindWeights[candidate];
+        }
+        const vector<int>& steps = distance[kind];
+        
+        int state = startState;
+        size_t length = 0;
+        while (true) {
+            if (length > 0 && steps[state] == 0 && (length >= MAX_LEXEME_BYTES || random() % 4 == 0)) break;
+            
+            candidates.clear();
+            for (const auto& edge : successors[state]) {
+                int remaining = steps[edge.second];
+                if (remaining != -1 && (length < MAX_LEXEME_BYTES || remaining < steps[state])) {
+                    candidates.push_back(edge);
+                }
+            }
+            if (candidates.empty()) break;  // only reachable in a state the kind wins
+            
+            const auto& edge = candidates[random() % candidates.size()];
+            buffer += edge.first;
+            state = edge.second;
+            length++;
+        }
+        
+        buffer += (random() % 12 == 0) ? '\n' : ' ';
+        tokens++;
+        
+        if (buffer.size() >= (1 << 20)) {
+            out.write(buffer.data(), buffer.size());
+            written += buffer.size();
+            buffer.clear();
+        }
+    }
+    out.write(buffer.data(), buffer.size());
+    
+    return tokens;
+}
+
+// ==================== StateProfile Implementation ====================
+
+uint64_t StateProfile::totalVisits() const {
+    uint64_t total = 0;
+    for (uint64_t visits : stateVisits) {
+        total += visits;
+    }
+    return total;
+}
+
+bool StateProfile::save(const string& filename) const {
+    ofstream outFile(filename);
+    if (!outFile.is_open()) {
+        cerr << "Error: Could not open file " << filename << " for writing." << endl;
+        return false;
+    }
+    
+    outFile << "# lexgen state profile\n";
+    outFile << "dfa " << dfaStates << " " << fingerprint << "\n";
+    for (size_t state = 0; state < stateVisits.size(); state++) {
+        if (stateVisits[state]) {
+            outFile << "state " << state << " " << stateVisits[state] << "\n";
+        }
+    }
+    for (const auto& edge : transitionVisits) {
+        outFile << "edge " << edge.first.first << " " << edge.first.second << " " << edge.second << "\n";
+    }
+    return !outFile.fail();
+}
+
+bool StateProfile::load(const string& filename) {
+    ifstream inFile(filename);
+    if (!inFile.is_open()) {
+        cerr << "Error: Could not open profile " << filename << endl;
+        return false;
+    }
+    
+    string line;
+    size_t lineNumber = 0;
+    bool sawDfa = false;
+    while (getline(inFile, line)) {
+        lineNumber++;
+        istringstream fields(line);
+        string kind;
+        if (!(fields >> kind) || kind[0] == '#') continue;
+        
+        bool valid = false;
+        if (kind == "dfa") {
+            size_t states;
+            uint64_t hash;
+            valid = static_cast<bool>(fields >> states >> hash);
+            if (valid && fingerprint != 0 && (states != dfaStates || hash != fingerprint)) {
+                cerr << "Error: " << filename << " was collected on a different DFA than the profile it is merged into"
+                     << endl;
+                return false;
+            }
+            if (valid) {
+                dfaStates = states;
+                fingerprint = hash;
+                sawDfa = true;
+            }
+        } else if (kind == "state") {
+            size_t state;
+            uint64_t visits;
+            valid = static_cast<bool>(fields >> state >> visits);
+            if (valid) {
+                if (state >= stateVisits.size()) stateVisits.resize(state + 1, 0);
+                stateVisits[state] += visits;
+            }
+        } else if (kind == "edge") {
+            int from, to;
+            uint64_t visits;
+            valid = static_cast<bool>(fields >> from >> to >> visits);
+            if (valid) {
+                transitionVisits[{from, to}] += visits;
+            }
+        }
+        if (!valid) {
+            cerr << "Error: " << filename << ":" << lineNumber << ": malformed profile line: " << line << endl;
+            return false;
+        }
+    }
+    if (!sawDfa) {
+        cerr << "Error: " << filename << " has no \"dfa\" fingerprint line; collect the profile again" << endl;
+        return false;
+    }
+    return true;
+}
+
+// ==================== PerfCounters Implementation ====================
+
+PerfSample::PerfSample() {
+    for (int event = 0; event < EVENT_COUNT; event++) {
+        counts[event] = 0;
+        valid[event] = false;
+    }
+}
+
+const char* PerfSample::eventName(int event) {
+    static const char* const names[EVENT_COUNT] = {
+        "cycles", "instructions", "L1D misses", "LLC misses", "branch misses"
+    };
+    return event >= 0 && event < EVENT_COUNT ? names[event] : "?";
+}
+
+bool PerfSample::any() const {
+    for (int event = 0; event < EVENT_COUNT; event++) {
+        if (valid[event]) return true;
+    }
+    return false;
+}
+
+double PerfSample::ipc() const {
+    if (!valid[CYCLES] || !valid[INSTRUCTIONS] || counts[CYCLES] == 0) {
+        return 0;
+    }
+    return static_cast<double>(counts[INSTRUCTIONS]) / counts[CYCLES];
+}
+
+PerfSample& PerfSample::operator+=(const PerfSample& other) {
+    for (int event = 0; event < EVENT_COUNT; event++) {
+        if (other.valid[event]) {
+            counts[event] += other.counts[event];
+            valid[event] = true;
+        }
+    }
+    return *this;
+}
+
+namespace {
+
+// 1234567 -> "1.23M"
+string abbreviated(double value) {
+    const char* suffixes[] = {"", "K", "M", "G", "T"};
+    int scale = 0;
+    while (value >= 1000 && scale < 4) {
+        value /= 1000;
+        scale++;
+    }
+    ostringstream out;
+    out << fixed << setprecision(scale ? 2 : 0) << value << suffixes[scale];
+    return out.str();
+}
+
+} // namespace
+
+string PerfSample::summary(size_t inputBytes) const {
+    if (!any()) {
+        return "counters unavailable";
+    }
+    ostringstream out;
+    for (int event = 0; event < EVENT_COUNT; event++) {
+        if (!valid[event]) continue;
+        if (out.tellp() > 0) out << ", ";
+        bool perKilobyte = inputBytes > 0 && event != CYCLES && event != INSTRUCTIONS;
+        if (perKilobyte) {
+            out << eventName(event) << " " << fixed << setprecision(2)
+                << counts[event] * 1024.0 / inputBytes << "/KB" << defaultfloat;
+        } else {
+            out << eventName(event) << " " << abbreviated(static_cast<double>(counts[event]));
+        }
+        if (event == INSTRUCTIONS && valid[CYCLES]) {
+            out << " (IPC " << fixed << setprecision(2) << ipc() << defaultfloat << ")";
+        }
+    }
+    return out.str();
+}
+
+PerfCounters::PerfCounters() {
+    for (int event = 0; event < PerfSample::EVENT_COUNT; event++) {
+        fds[event] = -1;
+        startCounts[event] = startRunning[event] = 0;
+    }
+    
+#ifdef __linux__
+    const uint64_t cacheReadMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const struct { uint32_t type; uint64_t config; } events[PerfSample::EVENT_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cacheReadMiss},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cacheReadMiss},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+    
+    // Separate events rather than one group: a group that does not fit the
+    // PMU never counts at all, while single events are multiplexed and scaled
+    for (int event = 0; event < PerfSample::EVENT_COUNT; event++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[event].type;
+        attr.config = events[event].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;  // worker threads of the parallel build
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        
+        fds[event] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+        if (fds[event] < 0 && error.empty()) {
+            error = string("perf_event_open(") + PerfSample::eventName(event) + "): " + strerror(errno);
+        }
+    }
+#else
+    error = "perf_event_open is Linux only";
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+#endif
+}
+
+bool PerfCounters::available() const {
+    for (int fd : fds) {
+        if (fd >= 0) return true;
+    }
+    return false;
+}
+
+namespace {
+
+// Multiplexing-scaled count and running time of one event. Counters run
+// from open to close and are differenced, since a reset does not clear
+// what exited threads have already folded in
+bool readCounter(int fd, uint64_t& count, uint64_t& running) {
+#ifdef __linux__
+    uint64_t values[3];  // value, time enabled, time running
+    if (fd < 0 || read(fd, values, sizeof(values)) != static_cast<ssize_t>(sizeof(values))) {
+        return false;
+    }
+    count = values[2] ? static_cast<uint64_t>(static_cast<double>(values[0]) * values[1] / values[2]) : 0;
+    running = values[2];
+    return true;
+#else
+    (void)fd;
+    (void)count;
+    (void)running;
+    return false;
+#endif
+}
+
+} // namespace
+
+void PerfCounters::start() {
+    for (int event = 0; event < PerfSample::EVENT_COUNT; event++) {
+        if (!readCounter(fds[event], startCounts[event], startRunning[event])) {
+            startCounts[event] = startRunning[event] = 0;
+        }
+    }
+}
+
+PerfSample PerfCounters::stop() {
+    PerfSample sample;
+    for (int event = 0; event < PerfSample::EVENT_COUNT; event++) {
+        uint64_t count, running;
+        // An event that was never scheduled in the interval has nothing to report
+        if (readCounter(fds[event], count, running) && running > startRunning[event]) {
+            sample.counts[event] = count > startCounts[event] ? count - startCounts[event] : 0;
+            sample.valid[event] = true;
+        }
+    }
+    return sample;
+}
+
+// ==================== Trace Implementation ====================
+
+namespace {
+
+struct TraceEvent {
+    string category;
+    string name;
+    string detail;
+    int64_t startMicros;
+    int64_t durationMicros;
+    int threadId;
+};
+
+mutex traceMutex;
+vector<TraceEvent> traceEvents;
+// steady_clock ticks at start(); atomic since worker threads read it unlocked
+atomic<int64_t> traceOriginTicks(chrono::steady_clock::now().time_since_epoch().count());
+atomic<int> traceThreadCount(0);
+
+// Small per-thread ids, in order of each thread's first event
+int traceThreadId() {
+    thread_local int id = ++traceThreadCount;
+    return id;
+}
+
+string jsonString(const string& text) {
+    string result = "\"";
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += static_cast<char>(c);
+        } else if (c < 0x20 || c >= 0x7f) {
+            // Bytes of arbitrary regexes need not be valid UTF-8
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            result += escaped;
+        } else {
+            result += static_cast<char>(c);
+        }
+    }
+    return result + "\"";
+}
+
+} // namespace
+
+atomic<bool> Trace::enabled(false);
+
+void Trace::start() {
+    lock_guard<mutex> lock(traceMutex);
+    traceEvents.clear();
+    traceOriginTicks.store(chrono::steady_clock::now().time_since_epoch().count(), memory_order_release);
+    enabled.store(true, memory_order_release);
+}
+
+int64_t Trace::now() {
+    chrono::steady_clock::duration origin(traceOriginTicks.load(memory_order_acquire));
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch() - origin).count();
+}
+
+void Trace::record(const char* category, const char* name, const string& detail,
+                   int64_t startMicros, int64_t endMicros) {
+    int threadId = traceThreadId();
+    lock_guard<mutex> lock(traceMutex);
+    // A scope that closes after finish() has no file left to go into
+    if (!enabled.load(memory_order_relaxed)) return;
+    traceEvents.push_back({category, name, detail, startMicros, endMicros - startMicros, threadId});
+}
+
+bool Trace::finish(const string& path) {
+    lock_guard<mutex> lock(traceMutex);
+    enabled.store(false, memory_order_relaxed);
+    
+    ofstream out(path);
+    if (!out.is_open()) {
+        cerr << "Error: Could not write trace " << path << endl;
+        return false;
+    }
+    
+    int pid = static_cast<int>(getpid());
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    set<int> threads;
+    for (const TraceEvent& event : traceEvents) {
+        threads.insert(event.threadId);
+    }
+    bool first = true;
+    for (int thread : threads) {
+        out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+            << ", \"tid\": " << thread << ", \"args\": {\"name\": \"thread " << thread << "\"}}";
+        first = false;
+    }
+    for (const TraceEvent& event : traceEvents) {
+        out << (first ? "" : ",\n") << "{\"name\": " << jsonString(event.name) << ", \"cat\": "
+            << jsonString(event.category) << ", \"ph\": \"X\", \"ts\": " << event.startMicros
+            << ", \"dur\": " << event.durationMicros << ", \"pid\": " << pid << ", \"tid\": " << event.threadId;
+        if (!event.detail.empty()) {
+            out << ", \"args\": {\"detail\": " << jsonString(event.detail) << "}";
+        }
+        out << "}";
+        first = false;
+    }
+    out << "\n]}\n";
+    traceEvents.clear();
+    return static_cast<bool>(out);
+}
+
+// ==================== WorkDirectory Implementation ====================
+
+WorkDirectory::WorkDirectory(const string& requested, const string& prefix) : path(requested), owned(false) {
+    if (!path.empty()) {
+        return;
+    }
+    string dirTemplate = "/tmp/" + prefix + "_XXXXXX";
+    if (!mkdtemp(&dirTemplate[0])) {
+        cerr << "Error: Could not create a temporary directory" << endl;
+        return;
+    }
+    path = dirTemplate;
+    owned = true;
+}
+
+WorkDirectory::~WorkDirectory() {
+    if (owned) {
+        error_code ignored;
+        filesystem::remove_all(path, ignored);
+    }
+}
+
+// ==================== GeneratedLibrary Implementation ====================
+
+GeneratedLibrary::GeneratedLibrary()
+    : handle(nullptr), lexer(nullptr), createFn(nullptr), destroyFn(nullptr), tokenizeFn(nullptr),
+      tokenizeAllFn(nullptr), errorCountFn(nullptr) {}
+
+GeneratedLibrary::~GeneratedLibrary() {
+    unload();
+}
+
+bool GeneratedLibrary::compile(const string& sourceFile, const string& libraryFile, const string& flags) {
+    TraceScope trace("emit", "compile", libraryFile);
+    const char* compiler = getenv("CXX");
+    string command = string(compiler && *compiler ? compiler : "c++") + " " + flags +
+                     " -shared -fPIC -fvisibility=hidden -o '" + libraryFile + "' '" + sourceFile + "'";
+    if (system(command.c_str()) != 0) {
+        cerr << "Error: compiler failed: " << command << endl;
+        return false;
+    }
+    return true;
+}
+
+bool GeneratedLibrary::load(const string& libraryFile, const string& prefix) {
+    unload();
+    
+    // A path without '/' would make dlopen search the library path instead
+    string path = libraryFile.find('/') == string::npos ? "./" + libraryFile : libraryFile;
+    handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        cerr << "Error: dlopen failed: " << dlerror() << endl;
+        return false;
+    }
+    
+    createFn = reinterpret_cast<CreateFn>(dlsym(handle, (prefix + "_create").c_str()));
+    destroyFn = reinterpret_cast<DestroyFn>(dlsym(handle, (prefix + "_destroy").c_str()));
+    tokenizeFn = reinterpret_cast<TokenizeFn>(dlsym(handle, (prefix + "_tokenize").c_str()));
+    tokenizeAllFn = reinterpret_cast<TokenizeAllFn>(dlsym(handle, (prefix + "_tokenize_all").c_str()));
+    errorCountFn = reinterpret_cast<ErrorCountFn>(dlsym(handle, (prefix + "_error_count").c_str()));
+    
+    if (!createFn || !destroyFn || !tokenizeAllFn || !errorCountFn) {
+        cerr << "Error: " << libraryFile << " does not export the " << prefix << "_* C API" << endl;
+        unload();
+        return false;
+    }
+    
+    lexer = createFn();
+    if (!lexer) {
+        unload();
+        return false;
+    }
+    return true;
+}
+
+void GeneratedLibrary::unload() {
+    if (lexer && destroyFn) {
+        destroyFn(lexer);
+    }
+    if (handle) {
+        dlclose(handle);
+    }
+    handle = nullptr;
+    lexer = nullptr;
+    createFn = nullptr;
+    destroyFn = nullptr;
+    tokenizeFn = nullptr;
+    tokenizeAllFn = nullptr;
+    errorCountFn = nullptr;
+}
+
+const ScanToken* GeneratedLibrary::tokenize(const char* input, size_t length, size_t& count) const {
+    count = 0;
+    return lexer ? tokenizeAllFn(lexer, input, length, &count) : nullptr;
+}
+
+size_t GeneratedLibrary::errorCount() const {
+    return lexer ? errorCountFn(lexer) : 0;
+}
+
+size_t GeneratedLibrary::tokenizeFresh(const char* input, size_t length, vector<ScanToken>& out) const {
+    if (!handle) return 0;
+    void* fresh = createFn();
+    if (!fresh) return 0;
+    size_t count = 0;
+    if (tokenizeFn) {
+        count = tokenizeFn(fresh, input, length, out.data(), out.size());
+        if (count > out.size()) {
+            out.resize(count);
+            tokenizeFn(fresh, input, length, out.data(), out.size());
+        }
+    } else {
+        const ScanToken* tokens = tokenizeAllFn(fresh, input, length, &count);
+        out.assign(tokens, tokens + count);
+    }
+    destroyFn(fresh);
+    return count;
+}
+
+// ==================== RegexParser Implementation ====================
+
+bool RegexParser::isValidRegex(const string& regex) {
+    int parenCount = 0;
+    for (char c : regex) {
+        if (c == '(') parenCount++;
+        if (c == ')') parenCount--;
+        if (parenCount < 0) return false;
+    }
+    return parenCount == 0;
+}
+
+string RegexParser::infixToPostfix(const string& regex) {
+    string result = "";
+    stack<char> opStack;
+    string processed = "";
+    
+    // Add explicit concatenation operator
+    for (size_t i = 0; i < regex.length(); i++) {
+        char c = regex[i];
+        processed += c;
+        
+        if (i + 1 < regex.length()) {
+            char next = regex[i + 1];
+            if ((c != '(' && c != '|') && (next != ')' && next != '|' && next != '*')) {
+                processed += '.';
+            }
+        }
+    }
+    
+    // Convert to postfix
+    for (char c : processed) {
+        if (!isOperator(c) && c != '(' && c != ')') {
+            result += c;
+        }
+        else if (c == '(') {
+            opStack.push(c);
+        }
+        else if (c == ')') {
+            while (!opStack.empty() && opStack.top() != '(') {
+                result += opStack.top();
+                opStack.pop();
+            }
+            if (!opStack.empty()) opStack.pop();  // Remove '('
+        }
+        else {
+            while (!opStack.empty() && opStack.top() != '(' && 
+                   getPrecedence(opStack.top()) >= getPrecedence(c)) {
+                result += opStack.top();
+                opStack.pop();
+            }
+            opStack.push(c);
+        }
+    }
+    
+    while (!opStack.empty()) {
+        result += opStack.top();
+        opStack.pop();
+    }
+    
+    return result;
+}
+
+int RegexParser::getPrecedence(char op) {
+    if (op == '*') return 3;
+    if (op == '.') return 2;
+    if (op == '|') return 1;
+    return 0;
+}
+
+bool RegexParser::isOperator(char c) {
+    return c == '*' || c == '|' || c == '.';
+}
+
+// ==================== NFACache Implementation ====================
+
+NFACache::NFACache() : hits(0), misses(0) {}
+
+NFA NFACache::get(const string& regex) {
+    {
+        lock_guard<mutex> guard(lock);
+        auto it = entries.find(regex);
+        if (it != entries.end()) {
+            hits++;
+            return it->second;
+        }
+    }
+    
+    // Construct outside the lock; a concurrent miss on the same regex just
+    // builds an identical NFA
+    NFA nfa = NFA::fromRegex(regex);
+    
+    lock_guard<mutex> guard(lock);
+    misses++;
+    entries.insert({regex, nfa});
+    return nfa;
+}
+
+size_t NFACache::getHits() const {
+    lock_guard<mutex> guard(lock);
+    return hits;
+}
+
+size_t NFACache::getMisses() const {
+    lock_guard<mutex> guard(lock);
+    return misses;
+}
+
+// ==================== LexicalAnalyzerGenerator Implementation ====================
+
+namespace {
+
+string trim(const string& text) {
+    size_t first = text.find_first_not_of(" \t\r\n");
+    if (first == string::npos) return "";
+    size_t last = text.find_last_not_of(" \t\r\n");
+    return text.substr(first, last - first + 1);
+}
+
+/**
+ * @brief Split a spec line into token type and pattern
+ *
+ * The pattern is the rest of the line; a pattern wrapped in double quotes
+ * may use \n, \t, \\ and \" escapes (e.g. to match whitespace).
+ */
+bool parseSpecLine(const string& line, string& tokenType, string& pattern) {
+    string text = trim(line);
+    size_t split = text.find_first_of(" \t");
+    if (split == string::npos) return false;
+    
+    tokenType = text.substr(0, split);
+    pattern = trim(text.substr(split));
+    
+    if (pattern.size() >= 2 && pattern.front() == '"' && pattern.back() == '"') {
+        string unquoted;
+        for (size_t i = 1; i + 1 < pattern.size(); i++) {
+            char c = pattern[i];
+            if (c == '\\' && i + 2 < pattern.size()) {
+                char next = pattern[++i];
+                if (next == 'n') c = '\n';
+                else if (next == 't') c = '\t';
+                else if (next == 'r') c = '\r';
+                else c = next;
+            }
+            unquoted += c;
+        }
+        pattern = unquoted;
+    }
+    
+    return !pattern.empty();
+}
+
+string directoryOf(const string& path) {
+    size_t slash = path.find_last_of('/');
+    return slash == string::npos ? "" : path.substr(0, slash + 1);
+}
+
+double millisecondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// One build phase: adds its hardware counts to stats.perf[name] and records
+// a trace event, each only when enabled. name must be a literal
+class BuildPhase {
+private:
+    PerfCounters* counters;
+    PerfSample* target;
+    const char* name;
+    int64_t startMicros;
+    
+public:
+    BuildPhase(PerfCounters* counters, BuildStats& stats, const char* name)
+        : counters(counters), target(counters ? &stats.perf[name] : nullptr), name(name),
+          startMicros(Trace::isEnabled() ? Trace::now() : -1) {
+        if (counters) counters->start();
+    }
+    
+    ~BuildPhase() { stop(); }
+    
+    void stop() {
+        if (counters) {
+            *target += counters->stop();
+            counters = nullptr;
+        }
+        if (startMicros >= 0) {
+            Trace::record("build", name, string(), startMicros, Trace::now());
+            startMicros = -1;
+        }
+    }
+};
+
+bool readWholeFile(const string& filename, string& content) {
+    ifstream inFile(filename, ios::binary);
+    if (!inFile.is_open()) {
+        return false;
+    }
+    content.assign(istreambuf_iterator<char>(inFile), istreambuf_iterator<char>());
+    return true;
+}
+
+// Fastest of several timed runs; repeats until minSeconds of total run time
+double bestSeconds(const function<void()>& run, double minSeconds = 0.2, int minRuns = 3) {
+    double best = 1e300;
+    double total = 0;
+    for (int runs = 0; runs < minRuns || total < minSeconds; runs++) {
+        auto start = chrono::steady_clock::now();
+        run();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        best = min(best, seconds);
+        total += seconds;
+    }
+    return best;
+}
+
+// Index of the first token that differs, count/expected.size() if one is a
+// prefix of the other, string::npos if the streams are identical
+size_t firstMismatch(const vector<ScanToken>& expected, const ScanToken* actual, size_t count) {
+    size_t common = min(expected.size(), count);
+    for (size_t i = 0; i < common; i++) {
+        const ScanToken& a = expected[i];
+        const ScanToken& b = actual[i];
+        if (a.kind != b.kind || a.offset != b.offset || a.length != b.length ||
+            a.line != b.line || a.column != b.column) {
+            return i;
+        }
+    }
+    return expected.size() == count ? string::npos : common;
+}
+
+bool sameTokens(const vector<ScanToken>& expected, const ScanToken* actual, size_t count) {
+    return firstMismatch(expected, actual, count) == string::npos;
+}
+
+// The prefix_create/_destroy/_tokenize_all/_error_count functions that
+// GeneratedLibrary loads, as a harness around a standalone cpp lexer: the
+// harness includes the generated source (its main() stays unused in the
+// shared object) and maps each Token back to its kind, offset and length
+bool writeCppTargetHarness(const string& harnessFile, const string& lexerSource, const string& prefix) {
+    ofstream out(harnessFile);
+    if (!out.is_open()) {
+        cerr << "Error: Could not open file " << harnessFile << " for writing." << endl;
+        return false;
+    }
+    out << "#include \"" << stemOf(lexerSource) << ".cpp\"\n";
+    out << "#include <cstdint>\n";
+    out << "#include <cstring>\n";
+    out << "\n#define HARNESS_API extern \"C\" __attribute__((visibility(\"default\")))\n";
+    out << "\nstruct " << prefix << "_token {\n";
+    out << "    int32_t kind;\n";
+    out << "    uint32_t line;\n";
+    out << "    uint32_t column;\n";
+    out << "    size_t offset;\n";
+    out << "    size_t length;\n";
+    out << "};\n";
+    out << "\nstruct " << prefix << "_lexer {\n";
+    out << "    LexicalAnalyzer analyzer;\n";
+    out << "    vector<" << prefix << "_token> tokens;\n";
+    out << "    size_t errors = 0;\n";
+    out << "};\n";
+    out << "\nHARNESS_API " << prefix << "_lexer* " << prefix << "_create() {\n";
+    out << "    return new " << prefix << "_lexer();\n";
+    out << "}\n";
+    out << "\nHARNESS_API void " << prefix << "_destroy(" << prefix << "_lexer* lexer) {\n";
+    out << "    delete lexer;\n";
+    out << "}\n";
+    out << "\nHARNESS_API const " << prefix << "_token* " << prefix << "_tokenize_all(" << prefix
+        << "_lexer* lexer, const char* input, size_t length, size_t* count) {\n";
+    out << "    string text(input, length);\n";
+    out << "    vector<Token> tokens = lexer->analyzer.tokenize(text, &lexer->errors);\n";
+    out << "    vector<size_t> lineStart(1, 0);\n";
+    out << "    for (size_t i = 0; i < length; i++) {\n";
+    out << "        if (input[i] == '\\n') lineStart.push_back(i + 1);\n";
+    out << "    }\n";
+    out << "    lexer->tokens.clear();\n";
+    out << "    for (const Token& token : tokens) {\n";
+    out << "        int32_t kind = -1;\n";
+    out << "        for (int i = 0; i < NUM_TOKEN_KINDS; i++) {\n";
+    out << "            if (token.type == TOKEN_NAMES[i]) kind = i;\n";
+    out << "        }\n";
+    out << "        size_t offset = lineStart[token.line - 1] + token.column - 1;\n";
+    out << "        lexer->tokens.push_back({kind, static_cast<uint32_t>(token.line), "
+           "static_cast<uint32_t>(token.column),\n";
+    out << "                                 offset, token.lexeme.size()});\n";
+    out << "    }\n";
+    out << "    *count = lexer->tokens.size();\n";
+    out << "    return lexer->tokens.data();\n";
+    out << "}\n";
+    out << "\nHARNESS_API size_t " << prefix << "_error_count(const " << prefix << "_lexer* lexer) {\n";
+    out << "    return lexer->errors;\n";
+    out << "}\n";
+    return out.good();
+}
+
+// The same loadable functions around a freestanding C99 lexer, which is
+// compiled as C next to the harness; its tokens already have the ScanToken layout
+bool writeCTargetHarness(const string& harnessFile, const string& lexerHeader, const string& prefix) {
+    ofstream out(harnessFile);
+    if (!out.is_open()) {
+        cerr << "Error: Could not open file " << harnessFile << " for writing." << endl;
+        return false;
+    }
+    out << "#include <vector>\n";
+    out << "extern \"C\" {\n";
+    out << "#include \"" << stemOf(lexerHeader) << ".h\"\n";
+    out << "}\n";
+    out << "\n#define HARNESS_API extern \"C\" __attribute__((visibility(\"default\")))\n";
+    out << "\nstruct " << prefix << "_lexer {\n";
+    out << "    std::vector<" << prefix << "_token> tokens;\n";
+    out << "    size_t errors = 0;\n";
+    out << "};\n";
+    out << "\nHARNESS_API " << prefix << "_lexer* " << prefix << "_create() {\n";
+    out << "    return new " << prefix << "_lexer();\n";
+    out << "}\n";
+    out << "\nHARNESS_API void " << prefix << "_destroy(" << prefix << "_lexer* lexer) {\n";
+    out << "    delete lexer;\n";
+    out << "}\n";
+    out << "\nHARNESS_API const " << prefix << "_token* " << prefix << "_tokenize_all(" << prefix
+        << "_lexer* lexer, const char* input, size_t length, size_t* count) {\n";
+    out << "    size_t total = " << prefix << "_tokenize(input, length, lexer->tokens.data(), "
+           "lexer->tokens.size(), &lexer->errors);\n";
+    out << "    if (total > lexer->tokens.size()) {\n";
+    out << "        lexer->tokens.resize(total);\n";
+    out << "        " << prefix << "_tokenize(input, length, lexer->tokens.data(), total, &lexer->errors);\n";
+    out << "    }\n";
+    out << "    *count = total;\n";
+    out << "    return lexer->tokens.data();\n";
+    out << "}\n";
+    out << "\nHARNESS_API size_t " << prefix << "_error_count(const " << prefix << "_lexer* lexer) {\n";
+    out << "    return lexer->errors;\n";
+    out << "}\n";
+    return out.good();
+}
+
+} // namespace
+
+LexicalAnalyzerGenerator::LexicalAnalyzerGenerator()
+    : threadCount(0), nfaCache(nullptr), verbose(true), printWarnings(true), perfCounters(false),
+      tableEntriesPerFile(DFA::DEFAULT_TABLE_ENTRIES_PER_FILE) {}
+
+void LexicalAnalyzerGenerator::addTokenPattern(const string& tokenType, const string& pattern) {
+    // Redefining a token keeps its original priority
+    if (tokenPatterns.find(tokenType) == tokenPatterns.end()) {
+        tokenOrder.push_back(tokenType);
+    }
+    tokenPatterns[tokenType] = pattern;
+}
+
+void LexicalAnalyzerGenerator::addPredefinedPatterns() {
+    // Keywords
+    addTokenPattern("KEYWORD_IF", "if");
+    addTokenPattern("KEYWORD_ELSE", "else");
+    addTokenPattern("KEYWORD_WHILE", "while");
+    addTokenPattern("KEYWORD_FOR", "for");
+    addTokenPattern("KEYWORD_INT", "int");
+    addTokenPattern("KEYWORD_FLOAT", "float");
+    addTokenPattern("KEYWORD_RETURN", "return");
+    
+    // Identifiers (simplified: letters followed by letters/digits)
+    addTokenPattern("IDENTIFIER", "(a|b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|q|r|s|t|u|v|w|x|y|z|A|B|C|D|E|F|G|H|I|J|K|L|M|N|O|P|Q|R|S|T|U|V|W|X|Y|Z)(a|b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|q|r|s|t|u|v|w|x|y|z|A|B|C|D|E|F|G|H|I|J|K|L|M|N|O|P|Q|R|S|T|U|V|W|X|Y|Z|0|1|2|3|4|5|6|7|8|9)*");
+    
+    // Numbers (simplified: one or more digits)
+    addTokenPattern("NUMBER", "(0|1|2|3|4|5|6|7|8|9)(0|1|2|3|4|5|6|7|8|9)*");
+    
+    // Operators
+    addTokenPattern("PLUS", "+");
+    addTokenPattern("MINUS", "-");
+    addTokenPattern("MULTIPLY", "*");
+    addTokenPattern("DIVIDE", "/");
+    addTokenPattern("ASSIGN", "=");
+    
+    // Relational operators
+    addTokenPattern("LESS_THAN", "<");
+    addTokenPattern("GREATER_THAN", ">");
+    
+    // Delimiters
+    addTokenPattern("SEMICOLON", ";");
+    addTokenPattern("LPAREN", "(");
+    addTokenPattern("RPAREN", ")");
+    addTokenPattern("LBRACE", "{");
+    addTokenPattern("RBRACE", "}");
+}
+
+string LexicalAnalyzerGenerator::getOption(const string& name, const string& fallback) const {
+    auto it = options.find(name);
+    return it != options.end() ? it->second : fallback;
+}
+
+bool LexicalAnalyzerGenerator::loadSpecFile(const string& filename) {
+    ifstream inFile(filename, ios::binary);
+    
+    if (!inFile.is_open()) {
+        cerr << "Error: Could not open spec file " << filename << endl;
+        return false;
+    }
+    
+    // Read the whole spec in one go and split lines in place
+    string content((istreambuf_iterator<char>(inFile)), istreambuf_iterator<char>());
+    
+    int lineNumber = 0;
+    size_t lineStart = 0;
+    map<string, int> ruleLines;  // token name -> line of its rule
+    while (lineStart < content.size()) {
+        size_t lineEnd = content.find('\n', lineStart);
+        if (lineEnd == string::npos) lineEnd = content.size();
+        string text = trim(content.substr(lineStart, lineEnd - lineStart));
+        lineStart = lineEnd + 1;
+        lineNumber++;
+        
+        // Blank lines, comments and lex-style "%%" section separators
+        if (text.empty() || text[0] == '#' || text == "%%") continue;
+        
+        if (text.compare(0, 7, "%option") == 0) {
+            // %option name=value [name=value ...]
+            istringstream fields(text.substr(7));
+            string field;
+            while (fields >> field) {
+                size_t equals = field.find('=');
+                if (equals == string::npos) {
+                    options[field] = "1";
+                } else {
+                    options[field.substr(0, equals)] = field.substr(equals + 1);
+                }
+            }
+            continue;
+        }
+        
+        string tokenType, pattern;
+        if (!parseSpecLine(text, tokenType, pattern) || !RegexParser::isValidRegex(pattern)) {
+            cerr << filename << ":" << lineNumber << ": invalid rule: " << text << endl;
+            return false;
+        }
+        // addTokenPattern would quietly replace the earlier pattern
+        auto first = ruleLines.find(tokenType);
+        if (first != ruleLines.end()) {
+            cerr << filename << ":" << lineNumber << ": duplicate rule for " << tokenType
+                 << " (first defined on line " << first->second << ")" << endl;
+            return false;
+        }
+        ruleLines[tokenType] = lineNumber;
+        addTokenPattern(tokenType, pattern);
+    }
+    
+    // Options that configure the build itself
+    string threads = getOption("threads");
+    if (!threads.empty()) {
+        size_t count;
+        if (!parsePositiveOption(threads, count) || count > numeric_limits<unsigned>::max()) {
+            cerr << filename << ": invalid threads '" << threads << "' (a positive integer)" << endl;
+            return false;
+        }
+        threadCount = static_cast<unsigned>(count);
+    }
+    string layout = getOption("layout");
+    if (!layout.empty() && layout != "table" && layout != "compact" && layout != "direct" && layout != "hybrid") {
+        cerr << filename << ": unknown layout '" << layout << "' (table, compact, direct or hybrid)" << endl;
+        return false;
+    }
+    string reorder = getOption("reorder");
+    if (!reorder.empty() && reorder != "locality" && reorder != "none") {
+        cerr << filename << ": unknown reorder '" << reorder << "' (locality or none)" << endl;
+        return false;
+    }
+    string tableChunk = getOption("table_chunk");
+    if (!tableChunk.empty() && !parsePositiveOption(tableChunk, tableEntriesPerFile)) {
+        cerr << filename << ": invalid table_chunk '" << tableChunk << "' (a positive integer)" << endl;
+        return false;
+    }
+    
+    return true;
+}
+
+void LexicalAnalyzerGenerator::determinize(const vector<NFA>& ruleNFAs, const vector<int>& rules,
+                                           PerfCounters* counters) {
+    vector<NFA> selected;
+    selected.reserve(rules.size());
+    for (int rule : rules) {
+        selected.push_back(ruleNFAs[rule]);
+    }
+    
+    // The caller's rule NFAs and this copy of the live ones stay alive
+    // together until subset construction is done
+    size_t ruleNfaBytes = ruleNFAs.capacity() * sizeof(NFA) + selected.capacity() * sizeof(NFA);
+    for (const NFA& nfa : ruleNFAs) {
+        ruleNfaBytes += nfa.memoryBytes();
+    }
+    for (const NFA& nfa : selected) {
+        ruleNfaBytes += nfa.memoryBytes();
+    }
+    ComponentMemory& ruleMemory = buildStats.memory["rule NFAs"];
+    ruleMemory.peakBytes = max(ruleMemory.peakBytes, ruleNfaBytes);
+    
+    // Combine the NFAs in priority order, so the result does not depend on scheduling
+    auto phase = chrono::steady_clock::now();
+    BuildPhase unionPhase(counters, buildStats, "union");
+    combinedNFA = NFA::unionAll(selected);
+    unionPhase.stop();
+    buildStats.unionMs += millisecondsSince(phase);
+    
+    phase = chrono::steady_clock::now();
+    BuildPhase subsetPhase(counters, buildStats, "subset construction");
+    finalDFA = (threadCount == 1) ? DFA::fromNFA(combinedNFA, &buildStats)
+                                  : DFA::fromNFAParallel(combinedNFA, threadCount, &buildStats);
+    subsetPhase.stop();
+    buildStats.subsetMs += millisecondsSince(phase);
+    buildStats.constructedDfaStates = finalDFA.getStates().size();
+    buildStats.constructedDfaTransitions = finalDFA.getTransitions().size();
+    
+    // Drop states that can never lead to a token; the scanners' dead row covers them
+    phase = chrono::steady_clock::now();
+    size_t constructedStates = finalDFA.getStates().size();
+    size_t constructedBytes = finalDFA.memoryBytes();
+    BuildPhase prunePhase(counters, buildStats, "prune");
+    finalDFA = finalDFA.pruned();
+    prunePhase.stop();
+    buildStats.pruneMs += millisecondsSince(phase);
+    
+    // The constructed and the pruned DFA exist side by side for a moment
+    ComponentMemory& dfaMemory = buildStats.memory["DFA"];
+    dfaMemory.peakBytes = max(dfaMemory.peakBytes, constructedBytes + finalDFA.memoryBytes());
+    ComponentMemory& nfaMemory = buildStats.memory["combined NFA"];
+    nfaMemory.peakBytes = max(nfaMemory.peakBytes, combinedNFA.memoryBytes());
+    if (verbose && finalDFA.getStates().size() < constructedStates) {
+        cout << "Pruned " << constructedStates - finalDFA.getStates().size() << " useless DFA states" << endl;
+    }
+    
+    // Set token types for accepting states from the rule that wins there
+    for (int state : finalDFA.getAcceptingStates()) {
+        int rule = finalDFA.getAcceptRule(state);
+        if (rule != -1) {
+            finalDFA.setTokenType(state, tokenOrder[rule]);
+        }
+    }
+}
+
+BuildStats LexicalAnalyzerGenerator::build() {
+    TraceScope trace("build", "build");
+    auto started = chrono::steady_clock::now();
+    hotStates.clear();
+    shadowedRules.clear();
+    warnings.clear();
+    buildStats = BuildStats();
+    
+    if (verbose) cout << "\nBuilding NFAs from regex patterns..." << endl;
+    
+    if (verbose) {
+        for (const string& tokenType : tokenOrder) {
+            cout << "  Processing: " << tokenType << " -> " << tokenPatterns[tokenType] << endl;
+        }
+    }
+    
+    if (tokenOrder.empty()) {
+        cerr << "Error: No token patterns defined!" << endl;
+        return buildStats;
+    }
+    
+    // Opened before any worker thread starts, so the counters follow them too
+    unique_ptr<PerfCounters> counters;
+    if (perfCounters) {
+        counters.reset(new PerfCounters());
+        if (!counters->available()) {
+            cerr << "Note: hardware counters unavailable (" << counters->getError() << ")" << endl;
+            counters.reset();
+        }
     }
     
-    outFile << "    }" << endl;
-    outFile << "    \n    void initializeAcceptingStates() {" << endl;
+    // Create NFA for each token pattern; rules are independent, so they are
+    // built on worker threads straight into their own slot
+    auto phase = chrono::steady_clock::now();
+    BuildPhase ruleNfaPhase(counters.get(), buildStats, "rule NFAs");
+    vector<NFA> nfas(tokenOrder.size());
+    parallelFor(tokenOrder.size(), threadCount, [&](size_t index) {
+        TraceScope trace("build", "rule", tokenOrder[index]);
+        const string& regex = tokenPatterns.at(tokenOrder[index]);
+        nfas[index] = nfaCache ? nfaCache->get(regex) : NFA::fromRegex(regex);
+        nfas[index].setAcceptRule(static_cast<int>(index));
+    });
+    ruleNfaPhase.stop();
+    buildStats.ruleNfaMs = millisecondsSince(phase);
     
-    // Add accepting states
-    for (int state : acceptingStates) {
-        outFile << "        acceptingStates[" << state << "] = true;" << endl;
-        auto it = stateToTokenType.find(state);
-        if (it != stateToTokenType.end()) {
-            outFile << "        stateToToken[" << state << "] = \"" << it->second << "\";" << endl;
-        }
-    }
-    
-    outFile << "    }" << endl;
-    
-    // Write getNextState method
-    outFile << "\n    int getNextState(int currentState, char symbol) {" << endl;
-    outFile << "        auto it = transitionTable.find({currentState, symbol});" << endl;
-    outFile << "        if (it != transitionTable.end()) {" << endl;
-    outFile << "            return it->second;" << endl;
-    outFile << "        }" << endl;
-    outFile << "        return -1;" << endl;
-    outFile << "    }" << endl;
-    
-    // Write tokenize method
-    outFile << "\npublic:" << endl;
-    outFile << "    LexicalAnalyzer() {" << endl;
-    outFile << "        initializeTransitionTable();" << endl;
-    outFile << "        initializeAcceptingStates();" << endl;
-    outFile << "    }" << endl;
-    
-    outFile << "\n    vector<Token> tokenize(const string& input) {" << endl;
-    outFile << "        vector<Token> tokens;" << endl;
-    outFile << "        int currentState = START_STATE;" << endl;
-    outFile << "        string currentLexeme = \"\";" << endl;
-    outFile << "        int line = 1, column = 1;" << endl;
-    outFile << "        int lastAcceptState = -1;" << endl;
-    outFile << "        int lastAcceptPos = -1;" << endl;
-    outFile << "        \n        for (size_t i = 0; i < input.length(); i++) {" << endl;
-    outFile << "            char c = input[i];" << endl;
-    outFile << "            int nextState = getNextState(currentState, c);" << endl;
-    outFile << "            \n            if (nextState != -1) {" << endl;
-    outFile << "                currentState = nextState;" << endl;
-    outFile << "                currentLexeme += c;" << endl;
-    outFile << "                \n                if (acceptingStates[currentState]) {" << endl;
-    outFile << "                    lastAcceptState = currentState;" << endl;
-    outFile << "                    lastAcceptPos = i;" << endl;
-    outFile << "                }" << endl;
-    outFile << "            } else {" << endl;
-    outFile << "                if (lastAcceptState != -1) {" << endl;
-    outFile << "                    Token token;" << endl;
-    outFile << "                    token.type = stateToToken[lastAcceptState];" << endl;
-    outFile << "                    token.lexeme = currentLexeme.substr(0, lastAcceptPos + 1);" << endl;
-    outFile << "                    token.line = line;" << endl;
-    outFile << "                    token.column = column;" << endl;
-    outFile << "                    tokens.push_back(token);" << endl;
-    outFile << "                    \n                    i = lastAcceptPos;" << endl;
-    outFile << "                    currentState = START_STATE;" << endl;
-    outFile << "                    currentLexeme = \"\";" << endl;
-    outFile << "                    lastAcceptState = -1;" << endl;
-    outFile << "                    lastAcceptPos = -1;" << endl;
-    outFile << "                } else {" << endl;
-    outFile << "                    // Error: no valid token" << endl;
-    outFile << "                    if (c != ' ' && c != '\\t' && c != '\\n') {" << endl;
-    outFile << "                        cerr << \"Lexical error at line \" << line << \", column \" << column << endl;" << endl;
-    outFile << "                    }" << endl;
-    outFile << "                    currentState = START_STATE;" << endl;
-    outFile << "                    currentLexeme = \"\";" << endl;
-    outFile << "                }" << endl;
-    outFile << "            }" << endl;
-    outFile << "            \n            if (c == '\\n') {" << endl;
-    outFile << "                line++;" << endl;
-    outFile << "                column = 1;" << endl;
-    outFile << "            } else {" << endl;
-    outFile << "                column++;" << endl;
-    outFile << "            }" << endl;
-    outFile << "        }" << endl;
-    outFile << "        \n        // Handle last token" << endl;
-    outFile << "        if (lastAcceptState != -1) {" << endl;
-    outFile << "            Token token;" << endl;
-    outFile << "            token.type = stateToToken[lastAcceptState];" << endl;
-    outFile << "            token.lexeme = currentLexeme;" << endl;
-    outFile << "            token.line = line;" << endl;
-    outFile << "            token.column = column;" << endl;
-    outFile << "            tokens.push_back(token);" << endl;
-    outFile << "        }" << endl;
-    outFile << "        \n        return tokens;" << endl;
-    outFile << "    }" << endl;
-    outFile << "};" << endl;
-    
-    // Write main function for testing
-    outFile << "\nint main() {" << endl;
-    outFile << "    LexicalAnalyzer analyzer;" << endl;
-    outFile << "    \n    cout << \"Enter input to tokenize (Ctrl+D to end):\" << endl;" << endl;
-    outFile << "    string input, line;" << endl;
-    outFile << "    while (getline(cin, line)) {" << endl;
-    outFile << "        input += line + \"\\n\";" << endl;
-    outFile << "    }" << endl;
-    outFile << "    \n    vector<Token> tokens = analyzer.tokenize(input);" << endl;
-    outFile << "    \n    cout << \"\\n========== TOKENS ==========\" << endl;" << endl;
-    outFile << "    for (const auto& token : tokens) {" << endl;
-    outFile << "        cout << \"<\" << token.type << \", \" << token.lexeme << \">\" << endl;" << endl;
-    outFile << "    }" << endl;
-    outFile << "    \n    return 0;" << endl;
-    outFile << "}" << endl;
-    
-    outFile.close();
-    cout << "\nC++ code generated successfully: " << filename << endl;
+    vector<int> rules(tokenOrder.size());
+    for (size_t index = 0; index < rules.size(); index++) {
+        rules[index] = static_cast<int>(index);
+    }
+    
+    if (verbose) cout << "\nConverting NFA to DFA..." << endl;
+    determinize(nfas, rules, counters.get());
+    
+    // A rule wins a state only if no earlier rule accepts there too. Rules that
+    // win nowhere (the start state does not count: scanners never emit empty
+    // tokens) can never produce a token
+    set<int> winningRules;
+    for (int state : finalDFA.getAcceptingStates()) {
+        if (state != finalDFA.getStartState()) {
+            winningRules.insert(finalDFA.getAcceptRule(state));
+        }
+    }
+    
+    vector<int> liveRules;
+    for (int rule : rules) {
+        if (winningRules.count(rule)) {
+            liveRules.push_back(rule);
+        } else {
+            shadowedRules.push_back(tokenOrder[rule]);
+            warnings.push_back("rule " + tokenOrder[rule] + " (" + tokenPatterns[tokenOrder[rule]] +
+                               ") can never match: it is shadowed by earlier rules or matches nothing; dropped");
+            if (printWarnings) {
+                cerr << "Warning: " << warnings.back() << endl;
+            }
+        }
+    }
+    
+    // Dropping a rule that wins nowhere leaves every other state's winner
+    // unchanged, so the rebuilt automaton scans exactly the same tokens
+    if (!shadowedRules.empty()) {
+        if (verbose) cout << "Rebuilding without " << shadowedRules.size() << " dead rule(s)..." << endl;
+        size_t before = finalDFA.getStates().size();
+        determinize(nfas, liveRules, counters.get());
+        buildStats.rebuilds++;
+        if (verbose) {
+            cout << "DFA states: " << before << " -> " << finalDFA.getStates().size() << endl;
+        }
+    }
+    
+    // Columns of the dense table every emitter and the Scanner derive from;
+    // they each lay out their own table, sized in EmitReport::tableBytes
+    phase = chrono::steady_clock::now();
+    BuildPhase classPhase(counters.get(), buildStats, "byte classes");
+    vector<int> byteClass;
+    int classCount = finalDFA.byteClasses(byteClass);
+    classPhase.stop();
+    buildStats.byteClassMs = millisecondsSince(phase);
+    
+    buildStats.nfaStates = combinedNFA.getStates().size();
+    buildStats.nfaEdges = combinedNFA.getTransitions().size();
+    buildStats.dfaStates = finalDFA.getStates().size();
+    buildStats.dfaTransitions = finalDFA.getTransitions().size();
+    buildStats.alphabetSize = finalDFA.getAlphabet().size();
+    buildStats.byteClasses = classCount;
+    buildStats.memory["subset sets"].peakBytes = buildStats.subsetSetBytesPeak;
+    buildStats.memory["combined NFA"].currentBytes = combinedNFA.memoryBytes();
+    buildStats.memory["DFA"].currentBytes = finalDFA.memoryBytes();
+    
+    // The rule NFAs are freed on return, except for the copies kept by the cache
+    size_t cachedNfaBytes = 0;
+    if (nfaCache) {
+        for (const NFA& nfa : nfas) {
+            cachedNfaBytes += nfa.memoryBytes();
+        }
+    }
+    buildStats.memory["rule NFAs"].currentBytes = cachedNfaBytes;
+    
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        buildStats.peakRssBytes = static_cast<size_t>(usage.ru_maxrss) * 1024;  // Linux reports KB
+    }
+    buildStats.totalMs = millisecondsSince(started);
+    
+    if (verbose) cout << "Build complete!" << endl;
+    return buildStats;
 }
 
-// ==================== RegexParser Implementation ====================
+EmitLayout LexicalAnalyzerGenerator::layoutFor(const string& name) const {
+    EmitLayout layout;
+    if (name == "compact") {
+        layout.compactTypes = true;
+    } else if (name == "direct") {
+        for (const auto& state : finalDFA.getStates()) {
+            layout.directStates.insert(state.id);
+        }
+    } else if (name == "hybrid") {
+        layout.directStates = hotStates;
+    }
+    return layout;
+}
 
-bool RegexParser::isValidRegex(const string& regex) {
-    int parenCount = 0;
-    for (char c : regex) {
-        if (c == '(') parenCount++;
-        if (c == ')') parenCount--;
-        if (parenCount < 0) return false;
+string LexicalAnalyzerGenerator::currentLayoutName() const {
+    return getOption("layout", hotStates.empty() ? "table" : "hybrid");
+}
+
+void LexicalAnalyzerGenerator::recordEmission() {
+    buildStats.tableBytes = lastEmit.tableBytes;
+    // Written straight to the output, the tables are only ever held by the lexer
+    ComponentMemory& tableMemory = buildStats.memory["emitted tables"];
+    tableMemory.currentBytes = lastEmit.tableBytes;
+    tableMemory.peakBytes = max(tableMemory.peakBytes, lastEmit.tableBytes);
+}
+
+NFA LexicalAnalyzerGenerator::allRulesNFA() const {
+    vector<NFA> nfas(tokenOrder.size());
+    for (size_t index = 0; index < tokenOrder.size(); index++) {
+        nfas[index] = NFA::fromRegex(tokenPatterns.at(tokenOrder[index]));
+        nfas[index].setAcceptRule(static_cast<int>(index));
     }
-    return parenCount == 0;
+    return NFA::unionAll(nfas);
 }
 
-string RegexParser::infixToPostfix(const string& regex) {
-    string result = "";
-    stack<char> opStack;
-    string processed = "";
+bool LexicalAnalyzerGenerator::verify(string& counterexample) const {
+    // Every rule, including the ones build() dropped as shadowed: dropping them
+    // must not change what the automaton scans
+    DFA reference = DFA::fromNFA(allRulesNFA());
+    for (int state : reference.getAcceptingStates()) {
+        int rule = reference.getAcceptRule(state);
+        if (rule != -1) {
+            reference.setTokenType(state, tokenOrder[rule]);
+        }
+    }
     
-    // Add explicit concatenation operator
-    for (size_t i = 0; i < regex.length(); i++) {
-        char c = regex[i];
-        processed += c;
-        
-        if (i + 1 < regex.length()) {
-            char next = regex[i + 1];
-            if ((c != '(' && c != '|') && (next != ')' && next != '|' && next != '*')) {
-                processed += '.';
-            }
+    // The start state is never re-entered (the union's start has no incoming
+    // edges) and scanners never emit empty tokens, so its acceptance is moot
+    DFA scanned = finalDFA;
+    scanned.removeAcceptingState(scanned.getStartState());
+    reference.removeAcceptingState(reference.getStartState());
+    return DFA::equivalent(scanned, reference, &counterexample);
+}
+
+void LexicalAnalyzerGenerator::reorderForLocality() {
+    finalDFA = finalDFA.renumbered(finalDFA.localityOrder());
+    hotStates.clear();
+}
+
+bool LexicalAnalyzerGenerator::collectProfile(const vector<string>& corpusFiles, StateProfile& profile) const {
+    if (finalDFA.getStates().empty()) {
+        cerr << "Error: build the lexical analyzer first!" << endl;
+        return false;
+    }
+    
+    size_t stateCount = finalDFA.getStates().size();
+    uint64_t fingerprint = finalDFA.fingerprint();
+    if (profile.fingerprint != 0 && (profile.dfaStates != stateCount || profile.fingerprint != fingerprint)) {
+        cerr << "Error: the loaded profile is for a different DFA (" << profile.dfaStates << " states, not "
+             << stateCount << "); collect it again" << endl;
+        return false;
+    }
+    profile.dfaStates = stateCount;
+    profile.fingerprint = fingerprint;
+    
+    Scanner scanner(finalDFA);
+    for (const string& corpusFile : corpusFiles) {
+        string content;
+        if (!readWholeFile(corpusFile, content)) {
+            cerr << "Error: Could not read corpus file " << corpusFile << endl;
+            return false;
         }
+        scanner.profile(content.data(), content.size(), profile);
+    }
+    return true;
+}
+
+bool LexicalAnalyzerGenerator::applyProfile(const StateProfile& profile, double hotFraction, size_t maxDirectStates) {
+    size_t stateCount = finalDFA.getStates().size();
+    if (profile.dfaStates != stateCount || profile.fingerprint != finalDFA.fingerprint()) {
+        cerr << "Error: the profile was collected on a different DFA (" << profile.dfaStates << " states, not "
+             << stateCount << "); collect it again for this spec" << endl;
+        return false;
     }
     
-    // Convert to postfix
-    for (char c : processed) {
-        if (!isOperator(c) && c != '(' && c != ')') {
-            result += c;
+    vector<uint64_t> visits(stateCount, 0);
+    for (size_t state = 0; state < stateCount && state < profile.stateVisits.size(); state++) {
+        visits[state] = profile.stateVisits[state];
+    }
+    
+    // Rows laid out along the most taken transitions; visited states come first
+    vector<int> order = finalDFA.localityOrder(&profile.transitionVisits);
+    finalDFA = finalDFA.renumbered(order);
+    vector<int> newId(stateCount);
+    for (size_t id = 0; id < order.size(); id++) {
+        newId[order[id]] = static_cast<int>(id);
+    }
+    
+    // Direct-code the most visited states
+    vector<int> byVisits(order);
+    stable_sort(byVisits.begin(), byVisits.end(), [&visits](int a, int b) {
+        return visits[a] > visits[b];
+    });
+    uint64_t total = 0;
+    for (uint64_t count : visits) {
+        total += count;
+    }
+    hotStates.clear();
+    uint64_t covered = 0;
+    for (size_t rank = 0; rank < byVisits.size() && hotStates.size() < maxDirectStates; rank++) {
+        if (total == 0 || covered >= hotFraction * total || visits[byVisits[rank]] == 0) break;
+        hotStates.insert(newId[byVisits[rank]]);
+        covered += visits[byVisits[rank]];
+    }
+    
+    if (verbose) {
+        cout << "\nApplied profile: " << total << " state visits, " << hotStates.size()
+             << " hot state(s) cover " << fixed << setprecision(1)
+             << (total ? 100.0 * covered / total : 0.0) << "%" << defaultfloat << endl;
+    }
+    return true;
+}
+
+bool LexicalAnalyzerGenerator::autotune(const vector<string>& corpusFiles, const string& outputBase,
+                                        const string& workDir) {
+    if (finalDFA.getStates().empty()) {
+        cerr << "Error: build the lexical analyzer first!" << endl;
+        return false;
+    }
+    
+    vector<string> corpus;
+    size_t corpusBytes = 0;
+    for (const string& corpusFile : corpusFiles) {
+        string content;
+        if (!readWholeFile(corpusFile, content)) {
+            cerr << "Error: Could not read corpus file " << corpusFile << endl;
+            return false;
         }
-        else if (c == '(') {
-            opStack.push(c);
+        corpusBytes += content.size();
+        corpus.push_back(content);
+    }
+    if (corpusBytes == 0) {
+        cerr << "Error: the autotune corpus is empty" << endl;
+        return false;
+    }
+    
+    WorkDirectory scratch(workDir);
+    if (!scratch.isValid()) {
+        return false;
+    }
+    const string& dir = scratch.getPath();
+    
+    // Reference token streams and throughput of the in-process engine
+    Scanner scanner(finalDFA);
+    vector<vector<ScanToken>> expected(corpus.size());
+    double referenceSeconds = 0;
+    for (size_t i = 0; i < corpus.size(); i++) {
+        TraceScope trace("lex", "in-process", corpusFiles[i]);
+        referenceSeconds += bestSeconds([&]() {
+            scanner.tokenize(corpus[i].data(), corpus[i].size(), expected[i]);
+        });
+    }
+    
+    vector<string> candidates = {"table", "compact"};
+    if (finalDFA.getStates().size() <= AUTOTUNE_DIRECT_STATE_LIMIT) {
+        candidates.push_back("direct");
+    }
+    if (!hotStates.empty()) {
+        candidates.push_back("hybrid");
+    }
+    
+    ostringstream report;
+    report << "========== Autotune Report ==========\n";
+    report << "Corpus: " << corpus.size() << " file(s), " << corpusBytes << " bytes; DFA: "
+           << finalDFA.getStates().size() << " states\n";
+    report << left << setw(12) << "Backend" << right << setw(12) << "Emit(ms)" << setw(14) << "Compile(ms)"
+           << setw(12) << "Source(B)" << setw(10) << "MB/s" << "  Status\n";
+    report << fixed << setprecision(2);
+    report << left << setw(12) << "in-process" << right << setw(12) << "-" << setw(14) << "-"
+           << setw(12) << "-" << setw(10) << corpusBytes / 1e6 / referenceSeconds << "  reference\n";
+    
+    string winner;
+    double winnerMBps = 0;
+    for (const string& candidate : candidates) {
+        string prefix = "autotune_" + candidate;
+        string base = dir + "/" + prefix;
+        string library = dir + "/lib" + prefix + ".so";
+        EmitLayout layout = layoutFor(candidate);
+        
+        EmitReport emitted;
+        auto start = chrono::steady_clock::now();
+        bool ok = finalDFA.generateCApiCode(base, &emitted, layout) &&
+                  GeneratedLibrary::compile(base + ".cpp", library);
+        double compileMs = millisecondsSince(start) - emitted.milliseconds;
+        
+        GeneratedLibrary generated;
+        if (!ok || !generated.load(library, prefix)) {
+            report << left << setw(12) << candidate << right << setw(12) << emitted.milliseconds
+                   << setw(14) << "-" << setw(12) << emitted.bytes << setw(10) << "-" << "  build failed\n";
+            continue;
         }
-        else if (c == ')') {
-            while (!opStack.empty() && opStack.top() != '(') {
-                result += opStack.top();
-                opStack.pop();
-            }
-            if (!opStack.empty()) opStack.pop();  // Remove '('
+        
+        double seconds = 0;
+        bool match = true;
+        for (size_t i = 0; i < corpus.size(); i++) {
+            size_t count = 0;
+            const ScanToken* tokens = nullptr;
+            TraceScope trace("lex", candidate.c_str(), corpusFiles[i]);
+            seconds += bestSeconds([&]() {
+                tokens = generated.tokenize(corpus[i].data(), corpus[i].size(), count);
+            });
+            match = match && sameTokens(expected[i], tokens, count);
         }
-        else {
-            while (!opStack.empty() && opStack.top() != '(' && 
-                   getPrecedence(opStack.top()) >= getPrecedence(c)) {
-                result += opStack.top();
-                opStack.pop();
-            }
-            opStack.push(c);
+        
+        double mbps = corpusBytes / 1e6 / seconds;
+        report << left << setw(12) << candidate << right << setw(12) << emitted.milliseconds
+               << setw(14) << compileMs << setw(12) << emitted.bytes << setw(10) << mbps
+               << "  " << (match ? "ok" : "MISMATCH (rejected)") << "\n";
+        
+        if (match && mbps > winnerMBps) {
+            winner = candidate;
+            winnerMBps = mbps;
         }
     }
     
-    while (!opStack.empty()) {
-        result += opStack.top();
-        opStack.pop();
+    if (winner.empty()) {
+        report << "No candidate produced the reference token stream\n";
+        cout << "\n" << report.str();
+        return false;
     }
     
-    return result;
+    report << "Winner: " << winner << " (" << winnerMBps << " MB/s) -> "
+           << outputBase << ".h, " << outputBase << ".cpp\n";
+    report << "=====================================\n";
+    cout << "\n" << report.str();
+    
+    ofstream reportFile(outputBase + ".autotune.txt");
+    reportFile << report.str();
+    
+    if (!finalDFA.generateCApiCode(outputBase, &lastEmit, layoutFor(winner))) {
+        return false;
+    }
+    recordEmission();
+    return true;
 }
 
-int RegexParser::getPrecedence(char op) {
-    if (op == '*') return 3;
-    if (op == '.') return 2;
-    if (op == '|') return 1;
-    return 0;
+bool LexicalAnalyzerGenerator::generateCApi(const string& basePath) {
+    if (!finalDFA.generateCApiCode(basePath, &lastEmit, layoutFor(currentLayoutName()))) {
+        return false;
+    }
+    recordEmission();
+    if (verbose) {
+        cout << "\nC API generated successfully: " << basePath << ".h, " << basePath << ".cpp" << endl;
+        cout << "  " << lastEmit.bytes << " bytes in " << lastEmit.files.size() << " file(s), "
+             << lastEmit.milliseconds << " ms" << endl;
+    }
+    return true;
 }
 
-bool RegexParser::isOperator(char c) {
-    return c == '*' || c == '|' || c == '.';
+bool LexicalAnalyzerGenerator::generateC(const string& basePath) {
+    if (!finalDFA.generateCCode(basePath, &lastEmit)) {
+        return false;
+    }
+    recordEmission();
+    if (verbose) {
+        cout << "\nC99 code generated successfully: " << basePath << ".h, " << basePath << ".c" << endl;
+        cout << "  " << lastEmit.bytes << " bytes in " << lastEmit.files.size() << " file(s), "
+             << lastEmit.milliseconds << " ms" << endl;
+    }
+    return true;
 }
 
-// ==================== LexicalAnalyzerGenerator Implementation ====================
-
-LexicalAnalyzerGenerator::LexicalAnalyzerGenerator() {}
-
-void LexicalAnalyzerGenerator::addTokenPattern(const string& tokenType, const string& pattern) {
-    tokenPatterns[tokenType] = pattern;
+bool LexicalAnalyzerGenerator::runGenerated(const vector<string>& sampleFiles, const string& workDir) {
+    if (finalDFA.getStates().empty()) {
+        cerr << "Error: build the lexical analyzer first!" << endl;
+        return false;
+    }
+    
+    WorkDirectory scratch(workDir);
+    if (!scratch.isValid()) {
+        return false;
+    }
+    const string& dir = scratch.getPath();
+    
+    string base = dir + "/generated_lexer";
+    string library = dir + "/libgenerated_lexer.so";
+    
+    EmitReport report;
+    if (!finalDFA.generateCApiCode(base, &report, layoutFor(currentLayoutName()))) {
+        return false;
+    }
+    
+    auto start = chrono::steady_clock::now();
+    if (!GeneratedLibrary::compile(base + ".cpp", library)) {
+        return false;
+    }
+    double compileMs = millisecondsSince(start);
+    
+    GeneratedLibrary generated;
+    if (!generated.load(library, "generated_lexer")) {
+        return false;
+    }
+    Scanner scanner(finalDFA);
+    
+    unique_ptr<PerfCounters> counters;
+    if (perfCounters) {
+        counters.reset(new PerfCounters());
+        if (!counters->available()) {
+            cerr << "Note: hardware counters unavailable (" << counters->getError() << ")" << endl;
+            counters.reset();
+        }
+    }
+    vector<string> perfLines;
+    
+    cout << "\n========== Generated Lexer Run ==========" << endl;
+    cout << "Library: " << library << " (emit " << fixed << setprecision(2) << report.milliseconds
+         << " ms, compile " << compileMs << " ms)" << endl;
+    cout << left << setw(32) << "Sample" << right << setw(12) << "Bytes" << setw(10) << "Tokens"
+         << setw(16) << "In-process MB/s" << setw(16) << "Generated MB/s" << "  Match" << endl;
+    
+    bool allMatch = true;
+    for (const string& sampleFile : sampleFiles) {
+        string input;
+        if (!readWholeFile(sampleFile, input)) {
+            cerr << "Error: Could not read sample " << sampleFile << endl;
+            allMatch = false;
+            continue;
+        }
+        
+        vector<ScanToken> tokens;
+        size_t count = 0;
+        const ScanToken* generatedTokens = nullptr;
+        
+        double inProcessSeconds, generatedSeconds;
+        {
+            TraceScope trace("lex", "in-process", sampleFile);
+            inProcessSeconds = bestSeconds([&]() {
+                scanner.tokenize(input.data(), input.size(), tokens);
+            });
+        }
+        {
+            TraceScope trace("lex", "generated", sampleFile);
+            generatedSeconds = bestSeconds([&]() {
+                generatedTokens = generated.tokenize(input.data(), input.size(), count);
+            });
+        }
+        
+        bool match = sameTokens(tokens, generatedTokens, count);
+        allMatch = allMatch && match;
+        double megabytes = input.size() / 1e6;
+        
+        // One more scan of each, outside the timed runs
+        if (counters) {
+            counters->start();
+            scanner.tokenize(input.data(), input.size(), tokens);
+            perfLines.push_back(sampleFile + " in-process: " + counters->stop().summary(input.size()));
+            counters->start();
+            generated.tokenize(input.data(), input.size(), count);
+            perfLines.push_back(sampleFile + " generated: " + counters->stop().summary(input.size()));
+        }
+        
+        cout << left << setw(32) << sampleFile << right << setw(12) << input.size() << setw(10) << tokens.size()
+             << setw(16) << megabytes / inProcessSeconds << setw(16) << megabytes / generatedSeconds
+             << "  " << (match ? "yes" : "NO") << endl;
+    }
+    cout << defaultfloat;
+    for (const string& line : perfLines) {
+        cout << line << endl;
+    }
+    cout << "=========================================" << endl;
+    
+    return allMatch;
 }
 
-void LexicalAnalyzerGenerator::build() {
-    vector<NFA> nfas;
+bool LexicalAnalyzerGenerator::differentialTest(const vector<string>& corpusFiles, size_t randomInputs,
+                                                unsigned seed, const string& workDir) {
+    if (finalDFA.getStates().empty()) {
+        cerr << "Error: build the lexical analyzer first!" << endl;
+        return false;
+    }
+    
+    struct TestInput {
+        string source;
+        string text;
+        bool checkReference;
+    };
+    vector<TestInput> inputs;
     
-    cout << "\nBuilding NFAs from regex patterns..." << endl;
+    // Random strings: mostly symbols the DFA knows, with whitespace and the
+    // occasional arbitrary byte to exercise error recovery
+    mt19937 random(seed);
+    vector<char> symbols(finalDFA.getAlphabet().begin(), finalDFA.getAlphabet().end());
+    symbols.push_back(' ');
+    symbols.push_back('\n');
+    for (size_t n = 0; n < randomInputs; n++) {
+        string text(random() % 65, ' ');
+        for (char& c : text) {
+            c = (random() % 16 == 0) ? static_cast<char>(random() % 256) : symbols[random() % symbols.size()];
+        }
+        inputs.push_back({"random #" + to_string(n), text, true});
+    }
     
-    // Create NFA for each token pattern
-    for (const auto& pattern : tokenPatterns) {
-        cout << "  Processing: " << pattern.first << " -> " << pattern.second << endl;
-        NFA nfa = NFA::fromRegex(pattern.second);
-        nfas.push_back(nfa);
+    for (const string& corpusFile : corpusFiles) {
+        string content;
+        if (!readWholeFile(corpusFile, content)) {
+            cerr << "Error: Could not read corpus file " << corpusFile << endl;
+            return false;
+        }
+        size_t start = 0;
+        while (start < content.size()) {
+            size_t end = min(content.size(), start + DIFFTEST_CHUNK_BYTES);
+            size_t lineEnd = content.rfind('\n', end - 1);
+            if (end < content.size() && lineEnd != string::npos && lineEnd >= start) {
+                end = lineEnd + 1;
+            }
+            inputs.push_back({corpusFile + " bytes " + to_string(start) + "-" + to_string(end),
+                              content.substr(start, end - start), end <= DIFFTEST_REFERENCE_BYTES});
+            start = end;
+        }
     }
     
-    // Combine all NFAs using union
-    if (nfas.empty()) {
-        cerr << "Error: No token patterns defined!" << endl;
-        return;
+    WorkDirectory scratch(workDir);
+    if (!scratch.isValid()) {
+        return false;
     }
+    const string& dir = scratch.getPath();
     
-    combinedNFA = nfas[0];
-    for (size_t i = 1; i < nfas.size(); i++) {
-        combinedNFA = NFA::union_op(combinedNFA, nfas[i]);
+    Scanner scanner(finalDFA);
+    // All rules, so a wrongly dropped shadowed rule shows up as a mismatch
+    NFA referenceNFA = allRulesNFA();
+    NFAScanner reference(referenceNFA, tokenOrder, scanner.getTokenNames());
+    
+    vector<string> layouts = {"table", "compact"};
+    if (finalDFA.getStates().size() <= AUTOTUNE_DIRECT_STATE_LIMIT) {
+        layouts.push_back("direct");
+    }
+    if (!hotStates.empty()) {
+        layouts.push_back("hybrid");
+    }
+    vector<GeneratedLibrary> libraries(layouts.size() + 2);
+    for (size_t i = 0; i < layouts.size(); i++) {
+        string prefix = "difftest_" + layouts[i];
+        string base = dir + "/" + prefix;
+        string library = dir + "/lib" + prefix + ".so";
+        if (!finalDFA.generateCApiCode(base, nullptr, layoutFor(layouts[i])) ||
+            !GeneratedLibrary::compile(base + ".cpp", library) || !libraries[i].load(library, prefix)) {
+            cerr << "Error: could not build the " << layouts[i] << " backend" << endl;
+            return false;
+        }
+    }
+    
+    // The standalone cpp target, its table split into several chunk files, and
+    // the C99 target, each loaded through a harness with the same functions
+    {
+        string prefix = "difftest_cpp";
+        string base = dir + "/" + prefix;
+        string library = dir + "/lib" + prefix + ".so";
+        EmitReport emitted;
+        string chunks;
+        bool built = finalDFA.generateCppCode(base + ".cpp", DIFFTEST_TABLE_ENTRIES_PER_FILE, &emitted) &&
+                     writeCppTargetHarness(base + "_harness.cpp", base + ".cpp", prefix);
+        for (size_t file = 1; file < emitted.files.size(); file++) {
+            chunks += " '" + emitted.files[file] + "'";
+        }
+        if (!built || !GeneratedLibrary::compile(base + "_harness.cpp", library, "-O2" + chunks) ||
+            !libraries[layouts.size()].load(library, prefix)) {
+            cerr << "Error: could not build the cpp backend" << endl;
+            return false;
+        }
+    }
+    {
+        string prefix = "difftest_c";
+        string base = dir + "/" + prefix;
+        string library = dir + "/lib" + prefix + ".so";
+        if (!finalDFA.generateCCode(base) || !writeCTargetHarness(base + "_harness.cpp", base + ".h", prefix) ||
+            !GeneratedLibrary::compile(base + "_harness.cpp", library, "-O2 -x c '" + base + ".c' -x c++") ||
+            !libraries[layouts.size() + 1].load(library, prefix)) {
+            cerr << "Error: could not build the c backend" << endl;
+            return false;
+        }
+    }
+    
+    // Backend 0 is the NFA reference, 1 the in-process Scanner, then the libraries;
+    // everything is compared against the in-process Scanner
+    vector<string> backends = {"nfa-reference", "in-process"};
+    for (const string& layout : layouts) {
+        backends.push_back("capi-" + layout);
     }
+    backends.push_back("cpp");
+    backends.push_back("c");
+    vector<size_t> checked(backends.size(), 0), mismatches(backends.size(), 0);
+    size_t totalTokens = 0;
     
-    cout << "\nConverting NFA to DFA..." << endl;
-    finalDFA = DFA::fromNFA(combinedNFA);
+    auto compare = [&](size_t backend, const TestInput& input, const vector<ScanToken>& expected,
+                       size_t expectedErrors, const ScanToken* actual, size_t count, size_t errors) {
+        checked[backend]++;
+        size_t mismatch = firstMismatch(expected, actual, count);
+        if (mismatch == string::npos && errors == expectedErrors) return;
+        
+        if (mismatches[backend]++ == 0) {
+            cerr << "MISMATCH " << backends[backend] << " on " << input.source << ": ";
+            if (mismatch == string::npos) {
+                cerr << errors << " error(s) instead of " << expectedErrors << endl;
+            } else {
+                size_t offset = mismatch < expected.size() ? expected[mismatch].offset : actual[mismatch].offset;
+                cerr << "token " << mismatch << " differs (input offset " << offset << ")" << endl;
+            }
+        }
+    };
     
-    // Set token types for accepting states
-    int tokenIndex = 0;
-    for (const auto& pattern : tokenPatterns) {
-        for (int state : finalDFA.getAcceptingStates()) {
-            finalDFA.setTokenType(state, pattern.first);
+    vector<ScanToken> expected, tokens;
+    for (const TestInput& input : inputs) {
+        size_t expectedErrors;
+        {
+            TraceScope trace("lex", "in-process", input.source);
+            expectedErrors = scanner.tokenize(input.text.data(), input.text.size(), expected);
+        }
+        checked[1]++;
+        totalTokens += expected.size();
+        
+        if (input.checkReference) {
+            TraceScope trace("lex", "nfa-reference", input.source);
+            size_t errors = reference.tokenize(input.text.data(), input.text.size(), tokens);
+            compare(0, input, expected, expectedErrors, tokens.data(), tokens.size(), errors);
+        }
+        for (size_t i = 0; i < libraries.size(); i++) {
+            TraceScope trace("lex", backends[i + 2].c_str(), input.source);
+            size_t count = 0;
+            const ScanToken* generated = libraries[i].tokenize(input.text.data(), input.text.size(), count);
+            compare(i + 2, input, expected, expectedErrors, generated, count, libraries[i].errorCount());
         }
-        tokenIndex++;
     }
     
-    cout << "Build complete!" << endl;
+    bool passed = true;
+    cout << "\n========== Differential Test ==========" << endl;
+    cout << "Inputs: " << randomInputs << " random (seed " << seed << "), "
+         << inputs.size() - randomInputs << " corpus chunk(s); " << totalTokens << " tokens" << endl;
+    cout << left << setw(20) << "Backend" << right << setw(10) << "Inputs" << setw(12) << "Mismatches" << endl;
+    for (size_t backend = 0; backend < backends.size(); backend++) {
+        cout << left << setw(20) << backends[backend] << right << setw(10) << checked[backend]
+             << setw(12) << mismatches[backend] << endl;
+        passed = passed && mismatches[backend] == 0;
+    }
+    cout << (passed ? "All backends agree" : "Backends DISAGREE") << endl;
+    cout << "=======================================" << endl;
+    
+    return passed;
 }
 
-void LexicalAnalyzerGenerator::generateCode(const string& outputFileName) {
-    finalDFA.generateCppCode(outputFileName, tokenPatterns);
+vector<string> LexicalAnalyzerGenerator::codeFiles(const string& outputFileName) const {
+    vector<string> files = {outputFileName};
+    vector<string> chunks = finalDFA.cppTableFiles(outputFileName, tableEntriesPerFile);
+    files.insert(files.end(), chunks.begin(), chunks.end());
+    return files;
+}
+
+bool LexicalAnalyzerGenerator::generateCode(const string& outputFileName) {
+    if (!finalDFA.generateCppCode(outputFileName, tableEntriesPerFile, &lastEmit)) {
+        return false;
+    }
+    recordEmission();
+    if (verbose) {
+        cout << "\nC++ code generated successfully: " << outputFileName << endl;
+        cout << "  " << lastEmit.bytes << " bytes in " << lastEmit.files.size() << " file(s), "
+             << lastEmit.milliseconds << " ms" << endl;
+    }
+    return true;
 }
 
 void LexicalAnalyzerGenerator::displayNFA() const {
@@ -714,3 +4451,211 @@ void LexicalAnalyzerGenerator::displayNFA() const {
 void LexicalAnalyzerGenerator::displayDFA() const {
     finalDFA.display();
 }
+
+// ==================== BatchBuilder Implementation ====================
+
+bool BatchBuilder::readManifest(const string& manifestPath, vector<pair<string, string>>& jobs) {
+    ifstream inFile(manifestPath);
+    
+    if (!inFile.is_open()) {
+        cerr << "Error: Could not open manifest " << manifestPath << endl;
+        return false;
+    }
+    
+    string baseDir = directoryOf(manifestPath);
+    auto resolve = [&baseDir](const string& path) {
+        return (path.empty() || path[0] == '/') ? path : baseDir + path;
+    };
+    
+    string line;
+    while (getline(inFile, line)) {
+        string text = trim(line.substr(0, line.find('#')));
+        if (text.empty()) continue;
+        
+        istringstream fields(text);
+        string specFile, outputFile;
+        fields >> specFile >> outputFile;
+        
+        jobs.push_back({resolve(specFile), resolve(outputFile)});
+    }
+    
+    return true;
+}
+
+vector<BatchBuilder::SpecResult> BatchBuilder::run(const string& manifestPath, unsigned threadCount) {
+    vector<pair<string, string>> jobs;
+    if (!readManifest(manifestPath, jobs)) {
+        return {};
+    }
+    
+    // Specs with common rules (keywords, numbers, ...) share their NFAs
+    NFACache cache;
+    vector<SpecResult> results(jobs.size());
+    vector<unique_ptr<LexicalAnalyzerGenerator>> generators(jobs.size());
+    
+    // Load every spec first so that each output path is known before anything is written
+    parallelFor(jobs.size(), threadCount, [&](size_t index) {
+        TraceScope trace("batch", "load", jobs[index].first);
+        SpecResult& result = results[index];
+        result.specFile = jobs[index].first;
+        result.outputFile = jobs[index].second;
+        result.success = false;
+        result.ruleCount = 0;
+        result.dfaStates = 0;
+        result.loadMs = result.buildMs = result.emitMs = 0;
+        
+        unique_ptr<LexicalAnalyzerGenerator> generator(new LexicalAnalyzerGenerator());
+        generator->setVerbose(false);
+        generator->setPrintWarnings(false);
+        generator->setNFACache(&cache);
+        
+        auto start = chrono::steady_clock::now();
+        bool loaded = generator->loadSpecFile(result.specFile);
+        result.loadMs = millisecondsSince(start);
+        result.ruleCount = generator->getTokenPatterns().size();
+        if (!loaded || result.ruleCount == 0) {
+            result.error = loaded ? "no rules" : "could not load spec";
+            return;
+        }
+        
+        // Parallelism comes from the pool, so each build runs sequentially
+        // whatever %option threads says
+        generator->setThreadCount(1);
+        
+        // Output and target as on the command line: manifest, then %option.
+        // A relative %option output is taken from the spec's own directory
+        if (result.outputFile.empty()) {
+            string output = generator->getOption("output", "");
+            if (output.empty()) {
+                result.outputFile = defaultOutputFile(result.specFile);
+            } else {
+                result.outputFile = output[0] == '/' ? output : directoryOf(result.specFile) + output;
+            }
+        }
+        result.target = generator->getOption("target", "cpp");
+        if (result.target != "cpp" && result.target != "capi" && result.target != "c") {
+            result.error = "unknown target " + result.target;
+            return;
+        }
+        generators[index] = move(generator);
+    });
+    
+    // Two specs writing the same file would overwrite each other; the later
+    // one in the manifest fails instead. Table chunk files are only known
+    // after the build, so a cpp spec also claims its whole <base>_table_*
+    // family here, and each chunk is checked against writers once built
+    auto pathKey = [](const string& file) {
+        return filesystem::path(file).lexically_normal().string();
+    };
+    map<string, string> writers;
+    for (size_t index = 0; index < results.size(); index++) {
+        SpecResult& result = results[index];
+        if (!generators[index]) continue;
+        
+        vector<string> files;
+        string base = withoutExtension(result.outputFile);
+        if (result.target == "capi") {
+            files = {base + ".h", base + ".cpp"};
+        } else if (result.target == "c") {
+            files = {base + ".h", base + ".c"};
+        } else {
+            files = {result.outputFile, base + "_table_*"};
+        }
+        for (const string& file : files) {
+            auto found = writers.find(pathKey(file));
+            if (found != writers.end()) {
+                result.error = "output " + file + " is also written by " + found->second;
+                break;
+            }
+        }
+        if (!result.error.empty()) {
+            generators[index].reset();
+            continue;
+        }
+        for (const string& file : files) {
+            writers[pathKey(file)] = result.specFile;
+        }
+    }
+    
+    parallelFor(jobs.size(), threadCount, [&](size_t index) {
+        if (!generators[index]) return;
+        TraceScope trace("batch", "spec", jobs[index].first);
+        SpecResult& result = results[index];
+        LexicalAnalyzerGenerator& generator = *generators[index];
+        
+        auto start = chrono::steady_clock::now();
+        generator.build();
+        result.buildMs = millisecondsSince(start);
+        result.dfaStates = generator.getDFA().getStates().size();
+        result.warnings = generator.getWarnings();
+        if (result.dfaStates == 0) {
+            result.error = "build failed";
+            generators[index].reset();
+            return;
+        }
+        if (result.target == "cpp") {
+            vector<string> files = generator.codeFiles(result.outputFile);
+            for (size_t i = 1; i < files.size(); i++) {
+                auto found = writers.find(pathKey(files[i]));
+                if (found != writers.end()) {
+                    result.error = "table file " + files[i] + " is also written by " + found->second;
+                    generators[index].reset();
+                    return;
+                }
+            }
+        }
+        
+        start = chrono::steady_clock::now();
+        bool written;
+        if (result.target == "capi") {
+            written = generator.generateCApi(withoutExtension(result.outputFile));
+            result.outputFile = withoutExtension(result.outputFile) + ".cpp";
+        } else if (result.target == "c") {
+            written = generator.generateC(withoutExtension(result.outputFile));
+            result.outputFile = withoutExtension(result.outputFile) + ".c";
+        } else {
+            written = generator.generateCode(result.outputFile);
+        }
+        generators[index].reset();
+        if (!written) {
+            result.error = "could not write output";
+            return;
+        }
+        result.emitMs = millisecondsSince(start);
+        result.success = true;
+    });
+    
+    return results;
+}
+
+void BatchBuilder::printReport(const vector<SpecResult>& results) {
+    vector<const SpecResult*> sorted;
+    for (const auto& result : results) {
+        sorted.push_back(&result);
+    }
+    stable_sort(sorted.begin(), sorted.end(), [](const SpecResult* a, const SpecResult* b) {
+        return a->loadMs + a->buildMs + a->emitMs > b->loadMs + b->buildMs + b->emitMs;
+    });
+    
+    size_t failures = 0;
+    double totalMs = 0;
+    
+    cout << "\n========== Batch Build Report ==========" << endl;
+    cout << left << setw(40) << "Spec" << right << setw(7) << "Rules" << setw(9) << "States"
+         << setw(11) << "Load(ms)" << setw(11) << "Build(ms)" << setw(11) << "Emit(ms)" << "  Status" << endl;
+    for (const SpecResult* result : sorted) {
+        cout << left << setw(40) << result->specFile << right << setw(7) << result->ruleCount
+             << setw(9) << result->dfaStates << fixed << setprecision(2)
+             << setw(11) << result->loadMs << setw(11) << result->buildMs << setw(11) << result->emitMs
+             << "  " << (result->success ? "ok -> " + result->outputFile + " (" + result->target + ")"
+                                         : "FAILED: " + result->error) << endl;
+        for (const string& warning : result->warnings) {
+            cout << "    warning: " << warning << endl;
+        }
+        totalMs += result->loadMs + result->buildMs + result->emitMs;
+        if (!result->success) failures++;
+    }
+    cout << "\n" << results.size() << " spec(s), " << failures << " failed, "
+         << fixed << setprecision(2) << totalMs << " ms total build work" << endl;
+    cout << defaultfloat << "========================================" << endl;
+}
@@ -10,6 +10,9 @@
 #include <queue>
 #include <algorithm>
 #include <fstream>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
 
 using namespace std;
 
@@ -59,6 +62,7 @@ private:
     vector<Transition> transitions;
     int startState;
     set<int> acceptingStates;
+    map<int, int> acceptRules;  // accepting state -> rule index (lower wins)
     int stateCounter;
     
 public:
@@ -69,6 +73,7 @@ public:
     static NFA concatenate(const NFA& nfa1, const NFA& nfa2);
     static NFA union_op(const NFA& nfa1, const NFA& nfa2);
     static NFA kleeneStar(const NFA& nfa);
+    static NFA unionAll(const vector<NFA>& nfas);  // n-way union, keeps each accepting state
     static NFA fromRegex(const string& regex);
     
     // Helper methods
@@ -76,10 +81,12 @@ public:
     void addTransition(int from, int to, char symbol);
     void setStartState(int stateId);
     void addAcceptingState(int stateId);
+    void setAcceptRule(int ruleIndex);  // tag every accepting state with a rule
     
     // Getters
     const vector<State>& getStates() const { return states; }
     const vector<Transition>& getTransitions() const { return transitions; }
+    const map<int, int>& getAcceptRules() const { return acceptRules; }
     int getStartState() const { return startState; }
     const set<int>& getAcceptingStates() const { return acceptingStates; }
     
@@ -88,9 +95,240 @@ public:
     set<int> epsilonClosure(const set<int>& states) const;
     set<int> move(const set<int>& states, char symbol) const;
     
+    // Estimated heap bytes held by this NFA
+    size_t memoryBytes() const;
+    
     void display() const;
 };
 
+/**
+ * @brief Dense transition table: one row per DFA state, one column per byte class
+ */
+struct FlatTable {
+    vector<int> byteClass;  // 256 entries: byte -> column
+    int classCount;
+    int stateCount;         // DFA states plus the dead row
+    int deadState;          // last row: every missing transition lands here and stays
+    vector<int> next;       // stateCount * classCount entries
+    
+    FlatTable() : byteClass(256, 0), classCount(0), stateCount(0), deadState(0) {}
+    
+    int at(int state, char symbol) const {
+        return next[state * classCount + byteClass[static_cast<unsigned char>(symbol)]];
+    }
+    
+    size_t memoryBytes() const { return (byteClass.capacity() + next.capacity()) * sizeof(int); }
+};
+
+/**
+ * @brief Hardware event counts over one measured interval
+ */
+struct PerfSample {
+    enum Event { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, EVENT_COUNT };
+    
+    uint64_t counts[EVENT_COUNT];
+    bool valid[EVENT_COUNT];  // false if the event could not be opened or never ran
+    
+    PerfSample();
+    
+    static const char* eventName(int event);
+    bool any() const;
+    double ipc() const;  // instructions per cycle, 0 unless both were counted
+    
+    PerfSample& operator+=(const PerfSample& other);
+    
+    // "cycles 1.2M, instructions 3.0M (IPC 2.50), ..."; with inputBytes > 0
+    // the miss counts are given per KB of input instead
+    string summary(size_t inputBytes = 0) const;
+};
+
+/**
+ * @brief Cycles, instructions, L1D/LLC read misses and branch misses of this
+ * process through perf_event_open
+ *
+ * User-space counts only, including threads started after construction.
+ * Events the kernel refuses (no PMU in a VM, perf_event_paranoid, non-Linux)
+ * are left out; available() is false when none could be opened.
+ */
+class PerfCounters {
+private:
+    int fds[PerfSample::EVENT_COUNT];
+    uint64_t startCounts[PerfSample::EVENT_COUNT];
+    uint64_t startRunning[PerfSample::EVENT_COUNT];
+    string error;
+    
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+    
+public:
+    PerfCounters();
+    ~PerfCounters();
+    
+    bool available() const;
+    const string& getError() const { return error; }  // why the first refused event failed
+    
+    // Counts between start() and stop(); both are one read() per event
+    void start();
+    PerfSample stop();
+};
+
+/**
+ * @brief Process-wide recording of scoped events as a Chrome trace_event file
+ *
+ * Off by default, and then a TraceScope costs one relaxed atomic load. The
+ * written JSON opens in Perfetto (ui.perfetto.dev) or chrome://tracing.
+ */
+class Trace {
+private:
+    static atomic<bool> enabled;
+    
+public:
+    static bool isEnabled() { return enabled.load(memory_order_relaxed); }
+    
+    // Start recording, dropping any earlier events
+    static void start();
+    
+    // Stop recording and write the events ("X" complete events, one track per thread);
+    // scopes still open at this point are dropped when they close
+    static bool finish(const string& path);
+    
+    // Microseconds since start()
+    static int64_t now();
+    
+    static void record(const char* category, const char* name, const string& detail,
+                       int64_t startMicros, int64_t endMicros);
+};
+
+/**
+ * @brief One traced event from construction to destruction
+ *
+ * category, name and detail are copied only while tracing is enabled.
+ */
+class TraceScope {
+private:
+    const char* category;
+    const char* name;
+    string detail;
+    int64_t startMicros;  // -1 when tracing was off at construction
+    
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+    
+public:
+    TraceScope(const char* category, const char* name) : category(category), name(name), startMicros(-1) {
+        if (Trace::isEnabled()) startMicros = Trace::now();
+    }
+    
+    // detail shows as args.detail, e.g. the rule or file being processed
+    TraceScope(const char* category, const char* name, const string& detail)
+        : category(category), name(name), startMicros(-1) {
+        if (Trace::isEnabled()) {
+            this->detail = detail;
+            startMicros = Trace::now();
+        }
+    }
+    
+    ~TraceScope() {
+        if (startMicros >= 0) Trace::record(category, name, detail, startMicros, Trace::now());
+    }
+};
+
+/**
+ * @brief Estimated heap bytes of one build component
+ */
+struct ComponentMemory {
+    size_t currentBytes;  // still held once build() returns
+    size_t peakBytes;     // largest amount alive at once during build()
+    
+    ComponentMemory() : currentBytes(0), peakBytes(0) {}
+};
+
+/**
+ * @brief Phase timings, work counters and automaton sizes of one build()
+ */
+struct BuildStats {
+    // Wall time per phase (summed over rebuilds after dropping dead rules)
+    double ruleNfaMs;   // regex parsing and Thompson construction of every rule
+    double unionMs;
+    double subsetMs;    // subset construction
+    double pruneMs;
+    double byteClassMs; // partitioning the bytes into table columns
+    double totalMs;
+    size_t rebuilds;    // re-determinizations after dropping dead rules
+    
+    // Subset construction work
+    uint64_t closureCalls;  // epsilon closures computed
+    uint64_t moveCalls;     // (DFA state, symbol) moves
+    
+    // Sizes; "constructed" is straight out of subset construction, the
+    // others are the final automaton
+    size_t nfaStates;
+    size_t nfaEdges;
+    size_t constructedDfaStates;
+    size_t constructedDfaTransitions;
+    size_t dfaStates;
+    size_t dfaTransitions;
+    size_t alphabetSize;
+    size_t byteClasses;
+    size_t tableBytes;  // EmitReport::tableBytes of the last generate call; 0 until emitted
+    
+    // Memory estimates by component ("rule NFAs", "combined NFA", "subset sets",
+    // "DFA", and "emitted tables" once generated) and the process peak RSS after the build
+    map<string, ComponentMemory> memory;
+    size_t subsetSetBytesPeak;  // state sets alive at once during subset construction
+    size_t peakRssBytes;
+    
+    // Hardware counters per phase ("rule NFAs", "union", "subset construction",
+    // "prune", "byte classes"); empty unless enabled with setPerfCounters
+    map<string, PerfSample> perf;
+    
+    BuildStats() : ruleNfaMs(0), unionMs(0), subsetMs(0), pruneMs(0), byteClassMs(0), totalMs(0), rebuilds(0),
+                   closureCalls(0), moveCalls(0), nfaStates(0), nfaEdges(0), constructedDfaStates(0),
+                   constructedDfaTransitions(0), dfaStates(0), dfaTransitions(0), alphabetSize(0),
+                   byteClasses(0), tableBytes(0), subsetSetBytesPeak(0), peakRssBytes(0) {}
+};
+
+/**
+ * @brief Summary of one code emission
+ */
+struct EmitReport {
+    vector<string> files;   // main file first, then table chunks
+    size_t bytes;
+    size_t tableBytes;      // BYTE_CLASS, TOKEN_KIND and TRANSITIONS at their emitted cell widths
+    double milliseconds;
+    
+    EmitReport() : bytes(0), tableBytes(0), milliseconds(0) {}
+};
+
+/**
+ * @brief Visit counts of DFA states and transitions over a corpus
+ */
+struct StateProfile {
+    vector<uint64_t> stateVisits;                  // state id -> times entered
+    map<pair<int, int>, uint64_t> transitionVisits;  // (from, to) -> times taken
+    size_t dfaStates;      // DFA the counts belong to: its state count ...
+    uint64_t fingerprint;  // ... and DFA::fingerprint(); 0 until collected or loaded
+    
+    StateProfile() : dfaStates(0), fingerprint(0) {}
+    
+    uint64_t totalVisits() const;
+    
+    // Plain text: a "dfa <states> <fingerprint>" line, then "state <id> <count>"
+    // and "edge <from> <to> <count>" lines
+    bool save(const string& filename) const;
+    bool load(const string& filename);
+};
+
+/**
+ * @brief How an emitted scanner represents its transitions
+ */
+struct EmitLayout {
+    bool compactTypes;      // narrowest integer types for the tables
+    set<int> directStates;  // states emitted as code instead of table rows
+    
+    EmitLayout() : compactTypes(false) {}
+};
+
 /**
  * @brief Deterministic Finite Automaton implementation
  */
@@ -102,19 +340,27 @@ private:
     set<int> acceptingStates;
     set<char> alphabet;
     map<int, string> stateToTokenType;
+    map<int, int> stateToRule;  // accepting state -> winning rule index
     
 public:
     DFA();
     
-    // Subset construction from NFA to DFA
-    static DFA fromNFA(const NFA& nfa);
+    // Subset construction from NFA to DFA; closure/move counts are added to
+    // *stats and subsetSetBytesPeak raised to this construction's peak
+    static DFA fromNFA(const NFA& nfa, BuildStats* stats = nullptr);
+    
+    // Multi-threaded subset construction (0 = hardware concurrency);
+    // produces exactly the same DFA as fromNFA
+    static DFA fromNFAParallel(const NFA& nfa, unsigned threadCount = 0, BuildStats* stats = nullptr);
     
     // Helper methods
     void addState(int stateId, bool isAccepting = false);
     void addTransition(int from, char symbol, int to);
     void setStartState(int stateId);
     void addAcceptingState(int stateId);
+    void removeAcceptingState(int stateId);  // also drops its token type and rule
     void setTokenType(int stateId, const string& tokenType);
+    void setAcceptRule(int stateId, int ruleIndex);
     
     // Getters
     const vector<State>& getStates() const { return states; }
@@ -122,15 +368,251 @@ public:
     int getStartState() const { return startState; }
     const set<int>& getAcceptingStates() const { return acceptingStates; }
     const set<char>& getAlphabet() const { return alphabet; }
+    const map<int, string>& getTokenTypes() const { return stateToTokenType; }
+    int getAcceptRule(int stateId) const;  // -1 if untagged
     
     // DFA operations
     int getNextState(int currentState, char symbol) const;
     bool accepts(const string& input) const;
     
+    // Group bytes with identical columns into classes: fills byteClass (256
+    // entries, byte -> column) and returns the class count
+    int byteClasses(vector<int>& byteClass) const;
+    
+    // The byte classes above, and a dense table laid out over them
+    FlatTable buildFlatTable() const;
+    
+    // Copy with state newId = order[newId]; order must be a permutation of the ids
+    DFA renumbered(const vector<int>& order) const;
+    
+    // Copy without states unreachable from the start or unable to reach an
+    // accepting state (the start state is always kept); ids stay in order
+    DFA pruned() const;
+    
+    // Ordering for renumbered(): breadth-first from the start state, placing
+    // each state's unplaced successors next to each other, the ones reached by
+    // the most bytes first. With taken ((from, to) -> times taken in a profile)
+    // only taken transitions are followed, the most taken first, and states
+    // never entered go last
+    vector<int> localityOrder(const map<pair<int, int>, uint64_t>* taken = nullptr) const;
+    
+    // Hash of the state count, start state, transitions and accept tags; a
+    // profile is only valid for a DFA with the same fingerprint
+    uint64_t fingerprint() const;
+    
+    // Hopcroft-Karp check that both DFAs accept the same strings with the same
+    // rule tags (token types when untagged). On a mismatch, *counterexample
+    // gets a shortest input on which they differ
+    static bool equivalent(const DFA& first, const DFA& second, string* counterexample = nullptr);
+    
+    // Mean |from - to| over all byte transitions, in table rows
+    double meanSuccessorDistance() const;
+    
+    // Estimated heap bytes held by this DFA
+    size_t memoryBytes() const;
+    
+    // Per-state index into tokenNames (-1 = not accepting); the numbering
+    // shared by every emitter and the in-process Scanner
+    vector<int> tokenKinds(int stateCount, vector<string>& tokenNames) const;
+    
     void display() const;
     
-    // Code generation
-    void generateCppCode(const string& filename, const map<string, string>& tokenPatterns) const;
+    // Code generation; tables larger than maxTableEntriesPerFile are split
+    // into separate <name>_table_N.cpp files that compile in parallel
+    static const size_t DEFAULT_TABLE_ENTRIES_PER_FILE = 1 << 18;
+    bool generateCppCode(const string& filename,
+                         size_t maxTableEntriesPerFile = DEFAULT_TABLE_ENTRIES_PER_FILE,
+                         EmitReport* report = nullptr) const;
+    
+    // The <name>_table_N.cpp files generateCppCode writes besides filename
+    // (none when the table fits in one file)
+    vector<string> cppTableFiles(const string& filename,
+                                 size_t maxTableEntriesPerFile = DEFAULT_TABLE_ENTRIES_PER_FILE) const;
+    
+    // Shared-library target: <basePath>.h with an extern "C" API and
+    // <basePath>.cpp implementing it (create / tokenize into buffer / destroy)
+    bool generateCApiCode(const string& basePath, EmitReport* report = nullptr,
+                          const EmitLayout& layout = EmitLayout()) const;
+    
+    // Freestanding C99 target: <basePath>.h/.c with static const tables in the
+    // narrowest integer types and a caller-buffer API; no heap, STL or stdio
+    bool generateCCode(const string& basePath, EmitReport* report = nullptr) const;
+};
+
+/**
+ * @brief A token as a byte range of the input; same layout as the
+ * <prefix>_token struct of the emitted C API
+ */
+struct ScanToken {
+    int32_t kind;      // index into the token names, see DFA::tokenKinds
+    uint32_t line;
+    uint32_t column;
+    size_t offset;
+    size_t length;
+};
+
+/**
+ * @brief In-process scanner running a DFA's flat table directly
+ */
+class Scanner {
+private:
+    FlatTable table;
+    vector<int> tokenKind;
+    vector<string> tokenNames;
+    int startState;
+    
+public:
+    explicit Scanner(const DFA& dfa);
+    
+    // Longest match, earliest rule on ties; returns the number of skipped
+    // (non-whitespace) error characters
+    size_t tokenize(const char* input, size_t length, vector<ScanToken>& tokens) const;
+    
+    // Same scan as tokenize, also counting every state entered and transition taken
+    size_t profile(const char* input, size_t length, StateProfile& profile) const;
+    
+    const vector<string>& getTokenNames() const { return tokenNames; }
+};
+
+/**
+ * @brief Reference scanner simulating an NFA with epsilonClosure / move
+ *
+ * Very slow, but shares no code with subset construction or the flat table,
+ * so it is the oracle when cross-checking the DFA backends.
+ */
+class NFAScanner {
+private:
+    const NFA& nfa;
+    vector<int> ruleKind;  // rule index -> index into the token names, -1 if absent
+    
+public:
+    // ruleNames in priority order (the NFA's accept tags); kinds are indices into tokenNames
+    NFAScanner(const NFA& nfa, const vector<string>& ruleNames, const vector<string>& tokenNames);
+    
+    // Same contract as Scanner::tokenize
+    size_t tokenize(const char* input, size_t length, vector<ScanToken>& tokens) const;
+};
+
+/**
+ * @brief Random token streams shaped by a DFA
+ *
+ * Each lexeme is a random walk from the start state to a state won by the
+ * chosen token kind; lexemes are separated by spaces and line breaks. Only
+ * mt19937_64 output is used (no std distributions), so a seed gives the same
+ * corpus everywhere.
+ */
+class CorpusGenerator {
+private:
+    vector<string> kindNames;
+    vector<double> kindWeights;
+    vector<int> stateKind;                        // state -> winning kind, -1 if none
+    vector<vector<pair<char, int>>> successors;   // state -> (byte, next state)
+    vector<vector<int>> distance;                 // kind -> state -> bytes to a state it wins, -1 = never
+    int startState;
+    
+public:
+    // Longer walks head straight for the nearest state won by their kind
+    static const size_t MAX_LEXEME_BYTES = 32;
+    
+    explicit CorpusGenerator(const DFA& dfa);
+    
+    // Token kinds (DFA::tokenKinds numbering); every producible kind starts with weight 1
+    const vector<string>& getKindNames() const { return kindNames; }
+    
+    // Replace the distribution: listed kinds get their weight, the rest 0.
+    // False (distribution unchanged) for unknown or never-producible kinds
+    bool setWeights(const map<string, double>& weights);
+    
+    // Write at least `bytes` bytes of tokens to out, ending after a separator;
+    // returns the number of tokens written
+    size_t generate(uint64_t bytes, uint64_t seed, ostream& out) const;
+};
+
+/**
+ * @brief Scratch directory for generated sources and compiled libraries
+ *
+ * An explicitly requested directory is used as is and kept. Otherwise a fresh
+ * /tmp/<prefix>_XXXXXX is created and removed with its contents on destruction.
+ */
+class WorkDirectory {
+private:
+    string path;
+    bool owned;
+    
+    WorkDirectory(const WorkDirectory&);
+    WorkDirectory& operator=(const WorkDirectory&);
+    
+public:
+    explicit WorkDirectory(const string& requested = "", const string& prefix = "lexgen");
+    ~WorkDirectory();
+    
+    bool isValid() const { return !path.empty(); }
+    const string& getPath() const { return path; }
+};
+
+/**
+ * @brief A generated C API lexer compiled to a shared object and loaded with dlopen
+ */
+class GeneratedLibrary {
+private:
+    typedef void* (*CreateFn)();
+    typedef void (*DestroyFn)(void*);
+    typedef size_t (*TokenizeFn)(void*, const char*, size_t, ScanToken*, size_t);
+    typedef const ScanToken* (*TokenizeAllFn)(void*, const char*, size_t, size_t*);
+    typedef size_t (*ErrorCountFn)(const void*);
+    
+    void* handle;
+    void* lexer;
+    CreateFn createFn;
+    DestroyFn destroyFn;
+    TokenizeFn tokenizeFn;  // optional: only the C API target exports _tokenize
+    TokenizeAllFn tokenizeAllFn;
+    ErrorCountFn errorCountFn;
+    
+    GeneratedLibrary(const GeneratedLibrary&);
+    GeneratedLibrary& operator=(const GeneratedLibrary&);
+    
+public:
+    GeneratedLibrary();
+    ~GeneratedLibrary();
+    
+    // Compile an emitted C API source into a shared object ($CXX or c++)
+    static bool compile(const string& sourceFile, const string& libraryFile,
+                        const string& flags = "-O2");
+    
+    // Load <prefix>_create/_tokenize_all/... from a compiled library
+    bool load(const string& libraryFile, const string& prefix);
+    void unload();
+    bool isLoaded() const { return lexer != nullptr; }
+    
+    // Tokens live in the library's buffer until the next call
+    const ScanToken* tokenize(const char* input, size_t length, size_t& count) const;
+    size_t errorCount() const;
+    
+    // A self-contained call: <prefix>_create, _tokenize into out (grown and
+    // retried when too small; _tokenize_all when there is no _tokenize) and
+    // _destroy. Returns the token count
+    size_t tokenizeFresh(const char* input, size_t length, vector<ScanToken>& out) const;
+};
+
+/**
+ * @brief Thread-safe cache of regex -> NFA, shared between generators
+ */
+class NFACache {
+private:
+    map<string, NFA> entries;
+    mutable mutex lock;
+    size_t hits;
+    size_t misses;
+    
+public:
+    NFACache();
+    
+    // Return the NFA for a regex, constructing it on first use
+    NFA get(const string& regex);
+    
+    size_t getHits() const;
+    size_t getMisses() const;
 };
 
 /**
@@ -139,8 +621,35 @@ public:
 class LexicalAnalyzerGenerator {
 private:
     map<string, string> tokenPatterns;  // tokenType -> regex pattern
+    vector<string> tokenOrder;          // token types in priority order
+    map<string, string> options;        // %option values from the spec file
     NFA combinedNFA;
     DFA finalDFA;
+    unsigned threadCount;  // 0 = use all hardware threads
+    NFACache* nfaCache;    // optional, not owned
+    bool verbose;
+    bool printWarnings;    // build() warnings to cerr as well as into warnings
+    bool perfCounters;     // hardware counters around build phases and --run scans
+    size_t tableEntriesPerFile;
+    EmitReport lastEmit;
+    set<int> hotStates;  // direct-coded by the "hybrid" layout, from applyProfile
+    vector<string> shadowedRules;  // rules dropped by the last build()
+    vector<string> warnings;       // messages of the last build()
+    BuildStats buildStats;
+    
+    // Union the given rules' NFAs (indices into tokenOrder) and determinize
+    void determinize(const vector<NFA>& ruleNFAs, const vector<int>& rules, PerfCounters* counters);
+    
+    // Copy the last emission's table size into buildStats
+    void recordEmission();
+    
+    // Union of every rule's NFA, the ones build() dropped as shadowed included,
+    // tagged with the rule index: the reference for verify() and differentialTest()
+    NFA allRulesNFA() const;
+    
+    // Layout named "table", "compact", "direct" or "hybrid" for the current DFA
+    EmitLayout layoutFor(const string& name) const;
+    string currentLayoutName() const;  // %option layout, else hybrid after a profile, else table
     
 public:
     LexicalAnalyzerGenerator();
@@ -148,17 +657,153 @@ public:
     // Add token pattern
     void addTokenPattern(const string& tokenType, const string& pattern);
     
-    // Build the lexical analyzer
-    void build();
+    // Add the built-in rules for a small C-like language
+    void addPredefinedPatterns();
+    
+    // Load a spec file: "%option name=value" lines, then
+    // "TOKEN_TYPE pattern" rules in priority order
+    bool loadSpecFile(const string& filename);
+    
+    // Worker threads used by build() (0 = hardware concurrency, 1 = sequential)
+    void setThreadCount(unsigned count) { threadCount = count; }
+    
+    // Reuse rule NFAs through a cache shared with other generators
+    void setNFACache(NFACache* cache) { nfaCache = cache; }
+    
+    // Enable/disable progress messages on cout
+    void setVerbose(bool enabled) { verbose = enabled; }
+    
+    // Print build() warnings on cerr (the default); either way they are kept
+    // for getWarnings()
+    void setPrintWarnings(bool enabled) { printWarnings = enabled; }
+    
+    // Read hardware counters around each build() phase (BuildStats::perf) and
+    // the scans of runGenerated; skipped with a note when unavailable
+    void setPerfCounters(bool enabled) { perfCounters = enabled; }
+    
+    // Split emitted transition tables into files of at most this many entries
+    void setTableEntriesPerFile(size_t entries) { tableEntriesPerFile = entries; }
+    
+    // Build the lexical analyzer. Rules that never win any DFA state (fully
+    // shadowed by earlier rules, or matching nothing) are reported and dropped.
+    // Returns the phase timings and sizes, also kept for getBuildStats()
+    BuildStats build();
     
     // Generate C++ code
-    void generateCode(const string& outputFileName);
+    bool generateCode(const string& outputFileName);
+    
+    // Every file generateCode writes: outputFileName, then any table chunks
+    vector<string> codeFiles(const string& outputFileName) const;
+    
+    // Generate <basePath>.h/.cpp exposing the lexer through a C ABI
+    // (%option layout=table|compact|direct|hybrid selects the representation;
+    // after applyProfile the default is hybrid)
+    bool generateCApi(const string& basePath);
+    
+    // Generate <basePath>.h/.c as freestanding C99
+    bool generateC(const string& basePath);
+    
+    // Emit the C API lexer into workDir, compile it as a shared object, load it
+    // with dlopen and compare its throughput on the samples with the in-process Scanner
+    bool runGenerated(const vector<string>& sampleFiles, const string& workDir = "");
+    
+    // Run every backend on the same inputs and require identical token streams
+    // and error counts: the NFA reference, the in-process Scanner, one
+    // compiled C API library per layout, the standalone cpp target (table cut
+    // into DIFFTEST_TABLE_ENTRIES_PER_FILE chunks) and the C99 target. Inputs
+    // are randomInputs random strings over the DFA alphabet (from seed) and
+    // the corpus files cut at line breaks
+    static const size_t DIFFTEST_CHUNK_BYTES = 4096;
+    static const size_t DIFFTEST_TABLE_ENTRIES_PER_FILE = 1024;
+    static const size_t DIFFTEST_REFERENCE_BYTES = 1 << 16;  // per file; the NFA reference is slow
+    bool differentialTest(const vector<string>& corpusFiles, size_t randomInputs, unsigned seed,
+                          const string& workDir = "");
+    
+    // Count state/transition visits of the built DFA over a corpus, adding to
+    // profile (which must then belong to this DFA)
+    bool collectProfile(const vector<string>& corpusFiles, StateProfile& profile) const;
+    
+    // Renumber the DFA along the profile's most taken transitions (adjacent
+    // table rows for hot paths) and mark the most visited states covering
+    // hotFraction of all visits, at most maxDirectStates, for direct coding;
+    // the rest stay table-driven. Fails if the profile is for another DFA
+    bool applyProfile(const StateProfile& profile, double hotFraction = 0.9, size_t maxDirectStates = 64);
+    const set<int>& getHotStates() const { return hotStates; }
+    
+    // Check the current (possibly reordered / profiled) DFA against a fresh
+    // DFA::fromNFA of all rules, including the dropped shadowed ones; on a
+    // mismatch counterexample is filled
+    bool verify(string& counterexample) const;
+    
+    // Renumber the DFA with DFA::localityOrder (drops any applied profile)
+    void reorderForLocality();
+    
+    // Build every candidate C API backend (table, compact table, direct-coded,
+    // and hybrid when a profile has been applied),
+    // measure each on the corpus, emit the fastest correct one to <outputBase>.h/.cpp
+    // and write the measurements to <outputBase>.autotune.txt
+    static const size_t AUTOTUNE_DIRECT_STATE_LIMIT = 4096;
+    bool autotune(const vector<string>& corpusFiles, const string& outputBase, const string& workDir = "");
+    
+    // Getters
+    const map<string, string>& getTokenPatterns() const { return tokenPatterns; }
+    const vector<string>& getTokenOrder() const { return tokenOrder; }
+    string getOption(const string& name, const string& fallback = "") const;
+    const NFA& getNFA() const { return combinedNFA; }
+    const DFA& getDFA() const { return finalDFA; }
+    const EmitReport& getLastEmitReport() const { return lastEmit; }
+    const vector<string>& getShadowedRules() const { return shadowedRules; }
+    const vector<string>& getWarnings() const { return warnings; }
+    const BuildStats& getBuildStats() const { return buildStats; }
     
     // Display information
     void displayNFA() const;
     void displayDFA() const;
 };
 
+/**
+ * @brief Builds every spec listed in a manifest on a bounded thread pool
+ *
+ * Manifest lines are "spec_file [output_file]"; relative paths are resolved
+ * against the manifest's directory and '#' starts a comment. Without an output
+ * file the spec's %option output applies, as on the command line, and
+ * %option target / layout pick the emitter.
+ */
+class BatchBuilder {
+public:
+    struct SpecResult {
+        string specFile;
+        string outputFile;
+        string target;            // cpp, capi or c, from %option target
+        bool success;
+        string error;
+        vector<string> warnings;  // printed by printReport, not by the workers
+        size_t ruleCount;
+        size_t dfaStates;
+        double loadMs;
+        double buildMs;
+        double emitMs;
+    };
+    
+    // Read (spec, output) pairs from a manifest; output is empty when not given
+    static bool readManifest(const string& manifestPath, vector<pair<string, string>>& jobs);
+    
+    // Build all specs with at most threadCount concurrent builds (0 = hardware concurrency)
+    static vector<SpecResult> run(const string& manifestPath, unsigned threadCount = 0);
+    
+    // Print per-spec timings, most expensive first
+    static void printReport(const vector<SpecResult>& results);
+};
+
+// Path without its extension ("dir/spec.l" -> "dir/spec")
+string withoutExtension(const string& path);
+
+// Output used when neither -o nor %option output is given: SPEC with .cpp
+string defaultOutputFile(const string& specFile);
+
+// Positive decimal integer for an option or flag; false for "abc", "0", "-3" or "4x"
+bool parsePositiveOption(const string& text, size_t& value);
+
 /**
  * @brief Utility class for regex parsing
  */
@@ -0,0 +1,355 @@
+#include "LexicalAnalyzerGenerator.h"
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <regex>
+#include <sstream>
+#include <functional>
+
+// Tokenization throughput benchmark: in-process Scanner, generated C API
+// libraries and a std::regex baseline over synthetic and real corpora.
+//
+//   g++ -std=c++17 -O2 -pthread -o lexbench benchmark.cpp LexicalAnalyzerGenerator.cpp -ldl
+//   ./lexbench [--reps N] [--warmup N] [--sizes BYTES,BYTES,...] [--perf] [CORPUS...]
+//
+// --perf adds IPC and L1D/LLC/branch misses per KB from hardware counters
+// over the timed repetitions, where perf_event_open is permitted. The
+// "+reorder" rows scan the same DFA renumbered by --reorder (localityOrder),
+// so their miss columns show whether the layout pays off on this machine.
+
+// std::regex is orders of magnitude slower; skip it above this input size
+const size_t REGEX_BASELINE_MAX_BYTES = 1 << 18;
+
+struct BenchmarkSpec {
+    string name;
+    LexicalAnalyzerGenerator generator;
+};
+
+struct Measurement {
+    double medianSeconds;
+    double p99Seconds;
+    size_t tokens;
+    PerfSample perf;  // summed over the timed repetitions
+};
+
+// Nearest-rank percentile of the run times (p in [0, 1])
+double percentile(vector<double> seconds, double p) {
+    sort(seconds.begin(), seconds.end());
+    size_t rank = static_cast<size_t>(p * seconds.size() + 0.999999);
+    return seconds[min(seconds.size(), max<size_t>(rank, 1)) - 1];
+}
+
+// Hardware counters for --perf, null when off or unavailable
+PerfCounters* perfCounters = nullptr;
+
+// Untimed warmup runs, then one timing per repetition; run returns the token count
+Measurement measure(int warmup, int repetitions, const function<size_t()>& run) {
+    size_t tokens = 0;
+    for (int i = 0; i < warmup; i++) {
+        tokens = run();
+    }
+    vector<double> seconds;
+    PerfSample perf;
+    for (int i = 0; i < repetitions; i++) {
+        if (perfCounters) perfCounters->start();
+        auto start = chrono::steady_clock::now();
+        tokens = run();
+        seconds.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        if (perfCounters) perf += perfCounters->stop();
+    }
+    return {percentile(seconds, 0.5), percentile(seconds, 0.99), tokens, perf};
+}
+
+// Random token stream walked from the DFA, cut to exactly bytes
+string syntheticCorpus(const DFA& dfa, size_t bytes, unsigned seed) {
+    ostringstream out;
+    CorpusGenerator(dfa).generate(bytes, seed, out);
+    string text = out.str();
+    text.resize(bytes);
+    return text;
+}
+
+// Our regex syntax in ECMAScript. RegexParser reads ( ) | * as operators and
+// . as its own concatenation operator, even when one is the whole pattern, so
+// . is dropped here and every other character is escaped where ECMAScript
+// would read it as special. A lone *, | or ) matches nothing and is dropped
+// by the generator, but a lone ( stays a literal in RegexParser and is
+// escaped to keep std::regex from rejecting it
+string toECMAScript(const string& pattern) {
+    string result;
+    for (char c : pattern) {
+        if (c == '.') {
+            continue;
+        }
+        bool special = string("\\^$+?[]{}").find(c) != string::npos ||
+                       (pattern.size() == 1 && string("()|*").find(c) != string::npos);
+        if (special) {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result;
+}
+
+/**
+ * @brief Longest-match, earliest-rule-on-ties scan built from one std::regex
+ * per rule
+ *
+ * Not an equivalent tokenizer: ECMAScript alternation takes the leftmost
+ * alternative that matches rather than the longest, so (a|ab) matches only
+ * "a" of "ab". The benchmark compares its token count with the DFA's and
+ * notes any difference under the std::regex row.
+ */
+class RegexBaseline {
+private:
+    vector<regex> rules;
+
+public:
+    // Rules the generator dropped as unmatchable are left out here too
+    explicit RegexBaseline(const LexicalAnalyzerGenerator& generator) {
+        const vector<string>& dropped = generator.getShadowedRules();
+        for (const string& tokenType : generator.getTokenOrder()) {
+            if (find(dropped.begin(), dropped.end(), tokenType) != dropped.end()) continue;
+            rules.emplace_back(toECMAScript(generator.getTokenPatterns().at(tokenType)), regex::optimize);
+        }
+    }
+    
+    size_t tokenize(const string& input) const {
+        size_t tokens = 0;
+        size_t pos = 0;
+        cmatch match;
+        while (pos < input.size()) {
+            size_t longest = 0;
+            for (const regex& rule : rules) {
+                if (regex_search(input.data() + pos, input.data() + input.size(), match, rule,
+                                 regex_constants::match_continuous) &&
+                    static_cast<size_t>(match.length(0)) > longest) {
+                    longest = match.length(0);
+                }
+            }
+            if (longest > 0) {
+                tokens++;
+                pos += longest;
+            } else {
+                pos++;
+            }
+        }
+        return tokens;
+    }
+};
+
+// Keywords kw<N>, identifiers, numbers and whitespace: a larger DFA than the C-like spec
+void addKeywordSpec(LexicalAnalyzerGenerator& generator, int keywordCount) {
+    for (int i = 0; i < keywordCount; i++) {
+        string keyword;
+        for (int n = i; ; n = n / 26 - 1) {
+            keyword.insert(keyword.begin(), static_cast<char>('a' + n % 26));
+            if (n < 26) break;
+        }
+        generator.addTokenPattern("KEYWORD_" + to_string(i), "kw" + keyword);
+    }
+    generator.addTokenPattern("IDENTIFIER",
+        "(a|b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|q|r|s|t|u|v|w|x|y|z)(a|b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|q|r|s|t|u|v|w|x|y|z|0|1|2|3|4|5|6|7|8|9)*");
+    generator.addTokenPattern("NUMBER", "(0|1|2|3|4|5|6|7|8|9)(0|1|2|3|4|5|6|7|8|9)*");
+    generator.addTokenPattern("WHITESPACE", "( |\n)( |\n)*");
+}
+
+vector<size_t> parseSizes(const string& list) {
+    vector<size_t> sizes;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        if (!item.empty()) {
+            sizes.push_back(static_cast<size_t>(atol(item.c_str())));
+        }
+    }
+    return sizes;
+}
+
+bool readFile(const string& path, string& content) {
+    ifstream in(path, ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    content.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    return true;
+}
+
+// Two decimals, or "-" for a counter that was not available
+string perfCell(bool valid, double value) {
+    if (!valid) {
+        return "-";
+    }
+    ostringstream out;
+    out << fixed << setprecision(2) << value;
+    return out.str();
+}
+
+string perKilobyte(const PerfSample& perf, int event, size_t bytes) {
+    return perfCell(perf.valid[event] && bytes > 0, perf.counts[event] * 1024.0 / max<size_t>(bytes, 1));
+}
+
+void printRow(const string& spec, const string& corpus, size_t bytes, const string& engine, const Measurement& m,
+              int repetitions) {
+    double megabytes = bytes / 1e6;
+    cout << left << setw(14) << spec << setw(26) << corpus << right << setw(10) << bytes << "  "
+         << left << setw(20) << engine << right << fixed << setprecision(2)
+         << setw(12) << megabytes / m.medianSeconds << setw(12) << megabytes / m.p99Seconds
+         << setw(14) << m.tokens / m.medianSeconds / 1e6;
+    if (perfCounters) {
+        size_t scanned = bytes * repetitions;
+        cout << setw(7) << perfCell(m.perf.ipc() > 0, m.perf.ipc())
+             << setw(10) << perKilobyte(m.perf, PerfSample::L1D_MISSES, scanned)
+             << setw(10) << perKilobyte(m.perf, PerfSample::LLC_MISSES, scanned)
+             << setw(10) << perKilobyte(m.perf, PerfSample::BRANCH_MISSES, scanned);
+    }
+    cout << defaultfloat << endl;
+}
+
+int main(int argc, char* argv[]) {
+    int warmup = 2;
+    int repetitions = 10;
+    vector<size_t> sizes = {1 << 16, 1 << 20, 1 << 24};
+    vector<string> corpusFiles;
+    bool perf = false;
+    
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--reps" && i + 1 < argc) {
+            repetitions = max(1, atoi(argv[++i]));
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            warmup = max(0, atoi(argv[++i]));
+        } else if (arg == "--sizes" && i + 1 < argc) {
+            sizes = parseSizes(argv[++i]);
+        } else if (arg == "--perf") {
+            perf = true;
+        } else if (arg == "-h" || arg == "--help") {
+            cout << "Usage: " << argv[0] << " [--reps N] [--warmup N] [--sizes BYTES,BYTES,...] [--perf] [CORPUS...]"
+                 << endl;
+            return 0;
+        } else {
+            corpusFiles.push_back(arg);
+        }
+    }
+    
+    vector<BenchmarkSpec> specs(3);
+    specs[0].name = "c-like";
+    specs[0].generator.addPredefinedPatterns();
+    specs[1].name = "keywords-100";
+    addKeywordSpec(specs[1].generator, 100);
+    specs[2].name = "keywords-1000";
+    addKeywordSpec(specs[2].generator, 1000);
+    
+    WorkDirectory scratch("", "lexbench");
+    if (!scratch.isValid()) {
+        return 1;
+    }
+    const string& dir = scratch.getPath();
+    
+    vector<pair<string, string>> realCorpora;
+    for (const string& path : corpusFiles) {
+        string content;
+        if (!readFile(path, content)) {
+            cerr << "Error: Could not read corpus " << path << endl;
+            return 1;
+        }
+        realCorpora.push_back({path, content});
+    }
+    
+    PerfCounters counters;
+    if (perf && counters.available()) {
+        perfCounters = &counters;
+    } else if (perf) {
+        cerr << "Note: hardware counters unavailable (" << counters.getError() << "); timing only" << endl;
+    }
+    
+    cout << "Warmup " << warmup << ", " << repetitions << " repetitions; MB/s at the median and p99 run time" << endl;
+    cout << left << setw(14) << "Spec" << setw(26) << "Corpus" << right << setw(10) << "Bytes" << "  "
+         << left << setw(20) << "Engine" << right << setw(12) << "MB/s p50" << setw(12) << "MB/s p99"
+         << setw(14) << "Mtokens/s";
+    if (perfCounters) {
+        cout << setw(7) << "IPC" << setw(10) << "L1D/KB" << setw(10) << "LLC/KB" << setw(10) << "BrMis/KB";
+    }
+    cout << endl;
+    
+    for (BenchmarkSpec& spec : specs) {
+        spec.generator.setVerbose(false);
+        spec.generator.build();
+        const DFA& dfa = spec.generator.getDFA();
+        
+        Scanner scanner(dfa);
+        RegexBaseline baseline(spec.generator);
+        
+        // The same automaton with rows in --reorder order
+        DFA reordered = dfa.renumbered(dfa.localityOrder());
+        Scanner reorderedScanner(reordered);
+        
+        // Table-driven and direct-coded generated libraries, plus the reordered table
+        vector<string> layouts = {"table"};
+        if (dfa.getStates().size() <= LexicalAnalyzerGenerator::AUTOTUNE_DIRECT_STATE_LIMIT) {
+            layouts.push_back("direct");
+        }
+        layouts.push_back("table+reorder");
+        vector<GeneratedLibrary> libraries(layouts.size());
+        for (size_t i = 0; i < layouts.size(); i++) {
+            EmitLayout layout;
+            if (layouts[i] == "direct") {
+                for (const auto& state : dfa.getStates()) {
+                    layout.directStates.insert(state.id);
+                }
+            }
+            const DFA& source = layouts[i] == "table+reorder" ? reordered : dfa;
+            string prefix = "bench_" + to_string(&spec - specs.data()) + "_" + to_string(i);
+            string base = dir + "/" + prefix;
+            string library = dir + "/lib" + prefix + ".so";
+            if (!source.generateCApiCode(base, nullptr, layout) ||
+                !GeneratedLibrary::compile(base + ".cpp", library) || !libraries[i].load(library, prefix)) {
+                cerr << "Error: could not build the " << layouts[i] << " library for " << spec.name << endl;
+                return 1;
+            }
+        }
+        
+        vector<pair<string, string>> corpora;
+        for (size_t bytes : sizes) {
+            corpora.push_back({"synthetic", syntheticCorpus(dfa, bytes, 42)});
+        }
+        corpora.insert(corpora.end(), realCorpora.begin(), realCorpora.end());
+        
+        for (const auto& corpus : corpora) {
+            const string& input = corpus.second;
+            vector<ScanToken> tokens;
+            
+            Measurement inProcess = measure(warmup, repetitions, [&]() {
+                scanner.tokenize(input.data(), input.size(), tokens);
+                return tokens.size();
+            });
+            printRow(spec.name, corpus.first, input.size(), "in-process", inProcess, repetitions);
+            printRow(spec.name, corpus.first, input.size(), "in-process+reorder",
+                     measure(warmup, repetitions, [&]() {
+                         reorderedScanner.tokenize(input.data(), input.size(), tokens);
+                         return tokens.size();
+                     }), repetitions);
+            for (size_t i = 0; i < libraries.size(); i++) {
+                printRow(spec.name, corpus.first, input.size(), "capi-" + layouts[i],
+                         measure(warmup, repetitions, [&]() {
+                             size_t count = 0;
+                             libraries[i].tokenize(input.data(), input.size(), count);
+                             return count;
+                         }), repetitions);
+            }
+            if (input.size() <= REGEX_BASELINE_MAX_BYTES) {
+                // A handful of runs is plenty at std::regex speeds
+                Measurement regexRun = measure(min(warmup, 1), min(repetitions, 3), [&]() {
+                    return baseline.tokenize(input);
+                });
+                printRow(spec.name, corpus.first, input.size(), "std::regex", regexRun, min(repetitions, 3));
+                if (regexRun.tokens != inProcess.tokens) {
+                    cout << "  note: std::regex found " << regexRun.tokens << " tokens, the DFA "
+                         << inProcess.tokens << " (ECMAScript | is leftmost-first, not longest)" << endl;
+                }
+            }
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include "LexicalAnalyzerGenerator.h"
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+#include <random>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Generator scalability benchmark: how build() and emission scale with the
+// number of rules, the pattern length and the alternation width.
+//
+//   g++ -std=c++17 -O2 -pthread -o lexbuildbench build_benchmark.cpp LexicalAnalyzerGenerator.cpp -ldl
+//   ./lexbuildbench [--max-rules N] [-j N]
+//
+// Every point runs in a forked child so its peak RSS is its own. The rule
+// sweeps stop at 10000 rules unless --max-rules raises it (e.g. to 100000).
+
+typedef vector<pair<string, string>> RuleList;  // (token type, pattern)
+
+struct SweepPoint {
+    string sweep;
+    string parameter;
+    RuleList rules;
+};
+
+// Distinct lowercase word for index, padded with seeded letters to length
+string wordFor(size_t index, size_t length, mt19937& random) {
+    string word;
+    for (size_t n = index; ; n = n / 26 - 1) {
+        word.insert(word.begin(), static_cast<char>('a' + n % 26));
+        if (n < 26) break;
+    }
+    while (word.size() < length) {
+        word += static_cast<char>('a' + random() % 26);
+    }
+    return word;
+}
+
+RuleList literalRules(size_t count, size_t length) {
+    mt19937 random(7);
+    RuleList rules;
+    for (size_t i = 0; i < count; i++) {
+        rules.push_back({"LITERAL_" + to_string(i), wordFor(i, length, random)});
+    }
+    return rules;
+}
+
+// A distinct literal prefix followed by a small shared starred tail
+RuleList regexRules(size_t count) {
+    mt19937 random(11);
+    RuleList rules;
+    for (size_t i = 0; i < count; i++) {
+        rules.push_back({"REGEX_" + to_string(i), wordFor(i, 6, random) + "(0|1)(a|b|0|1)*"});
+    }
+    return rules;
+}
+
+// Ten rules, each one alternation of width literals
+RuleList alternationRules(size_t width) {
+    mt19937 random(13);
+    RuleList rules;
+    size_t next = 0;
+    for (size_t i = 0; i < 10; i++) {
+        string pattern = "(";
+        for (size_t w = 0; w < width; w++) {
+            pattern += (w ? "|" : "") + wordFor(next++, 6, random);
+        }
+        rules.push_back({"ALTERNATION_" + to_string(i), pattern + ")"});
+    }
+    return rules;
+}
+
+// Write the rules as a spec, then time loading, building and emitting it
+bool runPoint(const SweepPoint& point, const string& dir, unsigned threads) {
+    string specFile = dir + "/spec.l";
+    {
+        ofstream spec(specFile);
+        spec << "%%\n";
+        for (const auto& rule : point.rules) {
+            spec << rule.first << " " << rule.second << "\n";
+        }
+        if (!spec) return false;
+    }
+    
+    LexicalAnalyzerGenerator generator;
+    generator.setVerbose(false);
+    generator.setThreadCount(threads);
+    
+    auto start = chrono::steady_clock::now();
+    if (!generator.loadSpecFile(specFile)) return false;
+    double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    
+    // Regex parsing on its own; build() parses again inside RuleNFA
+    start = chrono::steady_clock::now();
+    size_t postfixBytes = 0;
+    for (const auto& rule : generator.getTokenPatterns()) {
+        postfixBytes += RegexParser::infixToPostfix(rule.second).size();
+    }
+    double parseMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    if (postfixBytes == 0) return false;
+    
+    generator.build();
+    if (generator.getDFA().getStates().empty()) return false;
+    
+    EmitReport emitted;
+    if (!generator.getDFA().generateCApiCode(dir + "/lexer", &emitted)) return false;
+    
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    
+    const BuildStats& stats = generator.getBuildStats();
+    cout << left << setw(12) << point.sweep << setw(8) << point.parameter << right << fixed << setprecision(1)
+         << setw(8) << point.rules.size() << setw(10) << stats.nfaStates << setw(9) << stats.dfaStates
+         << setw(9) << loadMs << setw(9) << parseMs << setw(9) << stats.ruleNfaMs << setw(9) << stats.unionMs
+         << setw(10) << stats.subsetMs << setw(9) << stats.pruneMs << setw(9) << emitted.milliseconds
+         << setw(10) << stats.totalMs + emitted.milliseconds << setw(9) << usage.ru_maxrss / 1024.0 << endl;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    size_t maxRules = 10000;
+    unsigned threads = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--max-rules" && i + 1 < argc) {
+            maxRules = static_cast<size_t>(atol(argv[++i]));
+        } else if (arg == "-j" && i + 1 < argc) {
+            size_t count;
+            if (!parsePositiveOption(argv[++i], count) || count > numeric_limits<unsigned>::max()) {
+                cerr << "Invalid thread count: " << argv[i] << endl;
+                cout << "Usage: " << argv[0] << " [--max-rules N] [-j N]" << endl;
+                return 2;
+            }
+            threads = static_cast<unsigned>(count);
+        } else {
+            cout << "Usage: " << argv[0] << " [--max-rules N] [-j N]" << endl;
+            return arg == "-h" || arg == "--help" ? 0 : 2;
+        }
+    }
+    
+    vector<SweepPoint> points;
+    for (size_t count = 10; count <= maxRules; count *= 10) {
+        points.push_back({"literals", "len 8", literalRules(count, 8)});
+    }
+    for (size_t count = 10; count <= maxRules; count *= 10) {
+        points.push_back({"regexes", "-", regexRules(count)});
+    }
+    for (size_t length : {4, 16, 64, 256}) {
+        points.push_back({"length", to_string(length), literalRules(100, length)});
+    }
+    for (size_t width : {2, 8, 32, 128}) {
+        points.push_back({"width", to_string(width), alternationRules(width)});
+    }
+    
+    WorkDirectory scratch("", "lexbuildbench");
+    if (!scratch.isValid()) {
+        return 1;
+    }
+    
+    cout << "Times in ms; Load reads the spec file; Parse converts every rule's regex to postfix;"
+         << " RuleNFA is parsing again plus Thompson construction; RSS is the peak of the process"
+         << " building that point" << endl;
+    cout << left << setw(12) << "Sweep" << setw(8) << "Param" << right << setw(8) << "Rules"
+         << setw(10) << "NFA" << setw(9) << "DFA" << setw(9) << "Load" << setw(9) << "Parse" << setw(9) << "RuleNFA"
+         << setw(9) << "Union" << setw(10) << "Subset" << setw(9) << "Prune" << setw(9) << "Emit"
+         << setw(10) << "Total" << setw(9) << "RSS(MB)" << endl;
+    
+    bool allPassed = true;
+    for (const SweepPoint& point : points) {
+        cout.flush();
+        pid_t child = fork();
+        if (child == 0) {
+            _exit(runPoint(point, scratch.getPath(), threads) ? 0 : 1);
+        }
+        int status = 0;
+        if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            cout << left << setw(12) << point.sweep << setw(8) << point.parameter << right
+                 << setw(8) << point.rules.size() << "  failed" << endl;
+            allPassed = false;
+        }
+    }
+    
+    return allPassed ? 0 : 1;
+}
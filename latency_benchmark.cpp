@@ -0,0 +1,282 @@
+#include "LexicalAnalyzerGenerator.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <functional>
+#include <new>
+
+// Per-call latency of small inputs (100 B - 10 KB, the online-service case)
+// for each scanner backend, plus operator new calls per call.
+//
+//   g++ -std=c++17 -O2 -pthread -rdynamic -o lexlatency latency_benchmark.cpp LexicalAnalyzerGenerator.cpp -ldl
+//   ./lexlatency [SPEC] [--calls N] [--min BYTES] [--max BYTES] [--sizes FILE] [--seed S]
+//
+// -rdynamic exports the counting operator new below, so allocations made
+// inside the dlopen'ed generated libraries are counted as well.
+
+// Every replaceable operator new form (plain, array, nothrow, aligned) counts;
+// malloc calls made directly by C code do not.
+static atomic<size_t> allocationCount(0);
+
+static void* countedAllocate(size_t size, size_t alignment = 0) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    size = size ? size : 1;
+    if (alignment > alignof(max_align_t)) {
+        // aligned_alloc wants the size to be a multiple of the alignment
+        return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    }
+    return malloc(size);
+}
+
+void* operator new(size_t size) {
+    if (void* memory = countedAllocate(size)) {
+        return memory;
+    }
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    return countedAllocate(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    return countedAllocate(size);
+}
+
+void* operator new(size_t size, align_val_t alignment) {
+    if (void* memory = countedAllocate(size, static_cast<size_t>(alignment))) {
+        return memory;
+    }
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size, align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return countedAllocate(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return countedAllocate(size, static_cast<size_t>(alignment));
+}
+
+// Both malloc and aligned_alloc memory is released with free
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete[](void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+void operator delete[](void* memory, size_t) noexcept { free(memory); }
+void operator delete(void* memory, const nothrow_t&) noexcept { free(memory); }
+void operator delete[](void* memory, const nothrow_t&) noexcept { free(memory); }
+void operator delete(void* memory, align_val_t) noexcept { free(memory); }
+void operator delete[](void* memory, align_val_t) noexcept { free(memory); }
+void operator delete(void* memory, size_t, align_val_t) noexcept { free(memory); }
+void operator delete[](void* memory, size_t, align_val_t) noexcept { free(memory); }
+void operator delete(void* memory, align_val_t, const nothrow_t&) noexcept { free(memory); }
+void operator delete[](void* memory, align_val_t, const nothrow_t&) noexcept { free(memory); }
+
+struct Backend {
+    string name;
+    function<size_t(const char*, size_t)> tokenize;  // returns the token count
+};
+
+// Nearest-rank percentile (p in [0, 1]) of sorted values
+double percentile(const vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(ceil(p * sorted.size()));
+    return sorted[min(sorted.size(), max<size_t>(rank, 1)) - 1];
+}
+
+// Sizes replayed from a file (one byte count per line), else log-uniform in [minBytes, maxBytes]
+vector<size_t> requestSizes(const string& sizesFile, size_t calls, size_t minBytes, size_t maxBytes, mt19937_64& random) {
+    vector<size_t> sizes;
+    if (!sizesFile.empty()) {
+        ifstream in(sizesFile);
+        size_t size;
+        vector<size_t> recorded;
+        while (in >> size) {
+            recorded.push_back(size);
+        }
+        for (size_t i = 0; i < calls && !recorded.empty(); i++) {
+            sizes.push_back(recorded[i % recorded.size()]);
+        }
+        return sizes;
+    }
+    double low = log(static_cast<double>(max<size_t>(minBytes, 1)));
+    double high = log(static_cast<double>(max(maxBytes, minBytes)));
+    for (size_t i = 0; i < calls; i++) {
+        double unit = (random() >> 11) * (1.0 / 9007199254740992.0);
+        sizes.push_back(static_cast<size_t>(exp(low + unit * (high - low))));
+    }
+    return sizes;
+}
+
+int main(int argc, char* argv[]) {
+    string specFile, sizesFile;
+    size_t calls = 100000;
+    size_t minBytes = 100, maxBytes = 10240;
+    uint64_t seed = 1;
+    
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--calls" && i + 1 < argc) {
+            calls = static_cast<size_t>(atol(argv[++i]));
+        } else if (arg == "--min" && i + 1 < argc) {
+            minBytes = static_cast<size_t>(atol(argv[++i]));
+        } else if (arg == "--max" && i + 1 < argc) {
+            maxBytes = static_cast<size_t>(atol(argv[++i]));
+        } else if (arg == "--sizes" && i + 1 < argc) {
+            sizesFile = argv[++i];
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+        } else if (!arg.empty() && arg[0] != '-' && specFile.empty()) {
+            specFile = arg;
+        } else {
+            cout << "Usage: " << argv[0] << " [SPEC] [--calls N] [--min BYTES] [--max BYTES] [--sizes FILE] [--seed S]" << endl;
+            return arg == "-h" || arg == "--help" ? 0 : 2;
+        }
+    }
+    
+    LexicalAnalyzerGenerator generator;
+    generator.setVerbose(false);
+    if (specFile.empty()) {
+        generator.addPredefinedPatterns();
+    } else if (!generator.loadSpecFile(specFile)) {
+        return 1;
+    }
+    generator.build();
+    const DFA& dfa = generator.getDFA();
+    if (dfa.getStates().empty()) {
+        return 1;
+    }
+    
+    // Requests are slices of one synthetic token stream
+    mt19937_64 random(seed);
+    vector<size_t> sizes = requestSizes(sizesFile, calls, minBytes, maxBytes, random);
+    if (sizes.empty()) {
+        cerr << "Error: no request sizes" << endl;
+        return 1;
+    }
+    size_t largest = *max_element(sizes.begin(), sizes.end());
+    ostringstream stream;
+    CorpusGenerator(dfa).generate(max<size_t>(largest * 4, 1 << 20), seed, stream);
+    const string corpus = stream.str();
+    vector<size_t> offsets;
+    for (size_t size : sizes) {
+        offsets.push_back(random() % (corpus.size() - min(size, corpus.size()) + 1));
+    }
+    
+    WorkDirectory scratch("", "lexlatency");
+    if (!scratch.isValid()) {
+        return 1;
+    }
+    const string& dir = scratch.getPath();
+    
+    // A direct-coded lexer for a large DFA is one huge function that takes too
+    // long to compile; skip it above the autotuner's limit
+    vector<string> layouts = {"table"};
+    if (dfa.getStates().size() <= LexicalAnalyzerGenerator::AUTOTUNE_DIRECT_STATE_LIMIT) {
+        layouts.push_back("direct");
+    } else {
+        cout << "Skipping the direct backends: " << dfa.getStates().size() << " DFA states (limit "
+             << LexicalAnalyzerGenerator::AUTOTUNE_DIRECT_STATE_LIMIT << ")" << endl;
+    }
+    vector<GeneratedLibrary> libraries(layouts.size());
+    for (size_t i = 0; i < layouts.size(); i++) {
+        EmitLayout layout;
+        if (layouts[i] == "direct") {
+            for (const auto& state : dfa.getStates()) {
+                layout.directStates.insert(state.id);
+            }
+        }
+        string prefix = "latency_" + layouts[i];
+        if (!dfa.generateCApiCode(dir + "/" + prefix, nullptr, layout) ||
+            !GeneratedLibrary::compile(dir + "/" + prefix + ".cpp", dir + "/lib" + prefix + ".so") ||
+            !libraries[i].load(dir + "/lib" + prefix + ".so", prefix)) {
+            cerr << "Error: could not build the " << layouts[i] << " library" << endl;
+            return 1;
+        }
+    }
+    
+    // Fresh objects per call model a handler that builds its scanner state per
+    // request; the reused ones amortize it across requests. The per-call C API
+    // backends create and destroy a lexer around each call and only keep the
+    // caller's output buffer
+    Scanner sharedScanner(dfa);
+    vector<ScanToken> sharedTokens;
+    vector<ScanToken> callerTokens;
+    vector<Backend> backends = {
+        {"scanner-per-call", [&dfa](const char* input, size_t length) {
+            Scanner scanner(dfa);
+            vector<ScanToken> tokens;
+            scanner.tokenize(input, length, tokens);
+            return tokens.size();
+        }},
+        {"scanner-reused", [&](const char* input, size_t length) {
+            sharedScanner.tokenize(input, length, sharedTokens);
+            return sharedTokens.size();
+        }},
+    };
+    for (size_t i = 0; i < layouts.size(); i++) {
+        backends.push_back({"capi-" + layouts[i], [&libraries, i](const char* input, size_t length) {
+            size_t count = 0;
+            libraries[i].tokenize(input, length, count);
+            return count;
+        }});
+    }
+    for (size_t i = 0; i < layouts.size(); i++) {
+        backends.push_back({"capi-" + layouts[i] + "-per-call",
+                            [&libraries, &callerTokens, i](const char* input, size_t length) {
+            return libraries[i].tokenizeFresh(input, length, callerTokens);
+        }});
+    }
+    
+    size_t totalBytes = 0;
+    for (size_t size : sizes) {
+        totalBytes += min(size, corpus.size());
+    }
+    cout << sizes.size() << " calls, " << totalBytes / sizes.size() << " bytes on average ("
+         << (sizesFile.empty() ? "log-uniform " + to_string(minBytes) + "-" + to_string(maxBytes) : sizesFile)
+         << "); DFA " << dfa.getStates().size() << " states" << endl;
+    cout << "allocs/call counts operator new in every form (array, nothrow, aligned); direct malloc is not counted"
+         << endl;
+    cout << left << setw(22) << "Backend" << right << setw(11) << "p50 (us)" << setw(11) << "p99 (us)"
+         << setw(12) << "p999 (us)" << setw(11) << "max (us)" << setw(13) << "allocs/call" << setw(10) << "MB/s" << endl;
+    
+    vector<double> micros(sizes.size());
+    for (const Backend& backend : backends) {
+        // Warm caches, the branch predictor and the libraries' token buffers
+        for (size_t i = 0; i < min<size_t>(sizes.size(), 1000); i++) {
+            backend.tokenize(corpus.data() + offsets[i], min(sizes[i], corpus.size()));
+        }
+        
+        size_t allocationsBefore = allocationCount.load();
+        double totalSeconds = 0;
+        for (size_t i = 0; i < sizes.size(); i++) {
+            auto start = chrono::steady_clock::now();
+            backend.tokenize(corpus.data() + offsets[i], min(sizes[i], corpus.size()));
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            micros[i] = seconds * 1e6;
+            totalSeconds += seconds;
+        }
+        double allocationsPerCall = static_cast<double>(allocationCount.load() - allocationsBefore) / sizes.size();
+        
+        vector<double> sorted = micros;
+        sort(sorted.begin(), sorted.end());
+        cout << left << setw(22) << backend.name << right << fixed << setprecision(2)
+             << setw(11) << percentile(sorted, 0.5) << setw(11) << percentile(sorted, 0.99)
+             << setw(12) << percentile(sorted, 0.999) << setw(11) << sorted.back()
+             << setw(13) << allocationsPerCall << setw(10) << totalBytes / 1e6 / totalSeconds
+             << defaultfloat << endl;
+    }
+    
+    return 0;
+}
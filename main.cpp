@@ -1,4 +1,8 @@
 #include "LexicalAnalyzerGenerator.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
 
 void displayMenu() {
     cout << "\n========================================" << endl;
@@ -11,6 +15,8 @@ void displayMenu() {
     cout << "5. Generate C++ Code" << endl;
     cout << "6. Load Predefined Patterns (C-like Language)" << endl;
     cout << "7. Exit" << endl;
+    cout << "8. Batch Build from Manifest" << endl;
+    cout << "9. Compile, Load and Run Generated Lexer" << endl;
     cout << "========================================" << endl;
     cout << "Enter your choice: ";
 }
@@ -18,38 +24,7 @@ void displayMenu() {
 void loadPredefinedPatterns(LexicalAnalyzerGenerator& generator) {
     cout << "\nLoading predefined patterns for C-like language..." << endl;
     
-    // Keywords
-    generator.addTokenPattern("KEYWORD_IF", "if");
-    generator.addTokenPattern("KEYWORD_ELSE", "else");
-    generator.addTokenPattern("KEYWORD_WHILE", "while");
-    generator.addTokenPattern("KEYWORD_FOR", "for");
-    generator.addTokenPattern("KEYWORD_INT", "int");
-    generator.addTokenPattern("KEYWORD_FLOAT", "float");
-    generator.addTokenPattern("KEYWORD_RETURN", "return");
-    
-    // Identifiers (simplified: letters followed by letters/digits)
-    generator.addTokenPattern("IDENTIFIER", "(a|b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|q|r|s|t|u|v|w|x|y|z|A|B|C|D|E|F|G|H|I|J|K|L|M|N|O|P|Q|R|S|T|U|V|W|X|Y|Z)(a|b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|q|r|s|t|u|v|w|x|y|z|A|B|C|D|E|F|G|H|I|J|K|L|M|N|O|P|Q|R|S|T|U|V|W|X|Y|Z|0|1|2|3|4|5|6|7|8|9)*");
-    
-    // Numbers (simplified: one or more digits)
-    generator.addTokenPattern("NUMBER", "(0|1|2|3|4|5|6|7|8|9)(0|1|2|3|4|5|6|7|8|9)*");
-    
-    // Operators
-    generator.addTokenPattern("PLUS", "+");
-    generator.addTokenPattern("MINUS", "-");
-    generator.addTokenPattern("MULTIPLY", "*");
-    generator.addTokenPattern("DIVIDE", "/");
-    generator.addTokenPattern("ASSIGN", "=");
-    
-    // Relational operators
-    generator.addTokenPattern("LESS_THAN", "<");
-    generator.addTokenPattern("GREATER_THAN", ">");
-    
-    // Delimiters
-    generator.addTokenPattern("SEMICOLON", ";");
-    generator.addTokenPattern("LPAREN", "(");
-    generator.addTokenPattern("RPAREN", ")");
-    generator.addTokenPattern("LBRACE", "{");
-    generator.addTokenPattern("RBRACE", "}");
+    generator.addPredefinedPatterns();
     
     cout << "Predefined patterns loaded successfully!" << endl;
     cout << "\nSupported tokens:" << endl;
@@ -77,7 +52,382 @@ void printRegexHelp() {
     cout << "=======================================" << endl;
 }
 
-int main() {
+void printUsage(const char* program) {
+    cout << "Usage:" << endl;
+    cout << "  " << program << "                            interactive menu" << endl;
+    cout << "  " << program << " SPEC [-o OUT] [-j N] [-v]  build SPEC and write the lexer to OUT" << endl;
+    cout << "  " << program << " --batch MANIFEST [-j N]    build every spec listed in MANIFEST" << endl;
+    cout << "  " << program << " --predefined [...]         use the predefined C-like patterns as SPEC" << endl;
+    cout << "\nOptions:" << endl;
+    cout << "  -o OUT   output file (default: %option output, else SPEC with .cpp)" << endl;
+    cout << "  -t TGT   target: cpp (standalone program, default), capi (OUT.h + OUT.cpp" << endl;
+    cout << "           with an extern \"C\" API for a shared library) or c (OUT.h + OUT.c," << endl;
+    cout << "           freestanding C99 without heap allocation)" << endl;
+    cout << "  -j N     worker threads (default: all cores)" << endl;
+    cout << "  -v       print build progress" << endl;
+    cout << "  --trace FILE   write Chrome trace_event JSON of the build, emission and" << endl;
+    cout << "                 lexing runs to FILE (open it in Perfetto)" << endl;
+    cout << "  --perf         hardware counters (cycles, instructions, cache and branch" << endl;
+    cout << "                 misses) per build phase with -v, and per scan with --run" << endl;
+    cout << "  --reorder      renumber DFA states so likely successors are adjacent" << endl;
+    cout << "                 (static heuristic; also %option reorder=locality; compare the" << endl;
+    cout << "                 L1D/LLC misses of the +reorder rows of lexbench --perf)" << endl;
+    cout << "  --verify       check the final DFA against plain subset construction of the" << endl;
+    cout << "                 union of every rule's NFA, shadowed rules included (same" << endl;
+    cout << "                 strings, same rules); exit 1 with a counterexample" << endl;
+    cout << "  --profile CORPUS   count state visits on CORPUS (repeatable), renumber hot" << endl;
+    cout << "                 states first and direct-code them (direct coding only with" << endl;
+    cout << "                 -t capi, layout hybrid; cpp and c get just the renumbering)" << endl;
+    cout << "  --profile-in FILE  / --profile-out FILE   load / save a state profile" << endl;
+    cout << "  --autotune CORPUS  build every C API backend, measure it on CORPUS" << endl;
+    cout << "                 (repeatable) and emit the fastest to OUT.h/OUT.cpp; implies" << endl;
+    cout << "                 -t capi, and another -t or %option target is an error" << endl;
+    cout << "  --difftest CORPUS  run the NFA reference, the in-process scanner and every" << endl;
+    cout << "                 C API layout, the cpp and the c target on CORPUS (repeatable)" << endl;
+    cout << "                 and random inputs; exit 1 unless all token streams agree" << endl;
+    cout << "  --random N     random difftest inputs (default 1000), --seed S (default 1)" << endl;
+    cout << "  --gen-corpus SIZE  write SIZE bytes (suffix K/M/G) of random tokens from the" << endl;
+    cout << "                 DFA to --corpus-out FILE instead of emitting a lexer; --seed S," << endl;
+    cout << "                 --mix KIND=WEIGHT,... sets the token-kind distribution" << endl;
+    cout << "  --run SAMPLE   compile the lexer as a shared object, dlopen it and compare" << endl;
+    cout << "                 its throughput on SAMPLE with the in-process engine (repeatable)" << endl;
+    cout << "\nSpec file format:" << endl;
+    cout << "  %option output=lexer.cpp threads=4" << endl;
+    cout << "  %%" << endl;
+    cout << "  KEYWORD_IF   if" << endl;
+    cout << "  IDENTIFIER   (a|b|c)(a|b|c|0|1)*" << endl;
+    cout << "  WHITESPACE   \"( |\\t|\\n)( |\\t|\\n)*\"" << endl;
+    cout << "  Rules are listed in priority order; '#' starts a comment." << endl;
+}
+
+void printBuildStats(const BuildStats& stats) {
+    cout << "\n========== Build Statistics ==========" << endl;
+    cout << "Phases (ms): rule NFAs " << stats.ruleNfaMs << ", union " << stats.unionMs
+         << ", subset construction " << stats.subsetMs << ", prune " << stats.pruneMs
+         << ", byte classes " << stats.byteClassMs << "; total " << stats.totalMs << endl;
+    cout << "Subset construction: " << stats.closureCalls << " epsilon closures, "
+         << stats.moveCalls << " moves" << (stats.rebuilds ? " (including rebuilds)" : "") << endl;
+    cout << "NFA: " << stats.nfaStates << " states, " << stats.nfaEdges << " edges" << endl;
+    cout << "DFA: " << stats.constructedDfaStates << " states / " << stats.constructedDfaTransitions
+         << " transitions constructed, " << stats.dfaStates << " / " << stats.dfaTransitions << " final" << endl;
+    cout << "Alphabet: " << stats.alphabetSize << " symbols in " << stats.byteClasses << " byte classes; ";
+    if (stats.tableBytes) {
+        cout << "emitted tables " << stats.tableBytes << " bytes" << endl;
+    } else {
+        cout << "tables not emitted yet" << endl;
+    }
+    cout << "Memory (estimated KB, current / peak):";
+    for (const auto& component : stats.memory) {
+        cout << " " << component.first << " " << component.second.currentBytes / 1024 << " / "
+             << component.second.peakBytes / 1024 << ";";
+    }
+    cout << " peak RSS " << stats.peakRssBytes / (1024 * 1024) << " MB" << endl;
+    for (const auto& phase : stats.perf) {
+        cout << "Counters, " << phase.first << ": " << phase.second.summary() << endl;
+    }
+    cout << "======================================" << endl;
+}
+
+// Input bytes for a message: printable ASCII as is, the rest as C escapes
+string printableString(const string& input) {
+    string result;
+    for (char c : input) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        if (c == '\n') {
+            result += "\\n";
+        } else if (c == '\t') {
+            result += "\\t";
+        } else if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (byte < 0x20 || byte >= 0x7f) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\x%02x", byte);
+            result += escaped;
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+// "64K", "10M", "2G" (powers of 1024) or a plain byte count; 0 if malformed
+uint64_t parseByteSize(const string& text) {
+    char* end = nullptr;
+    uint64_t value = strtoull(text.c_str(), &end, 10);
+    string suffix = end ? end : "";
+    if (suffix.empty()) return value;
+    if (suffix == "K" || suffix == "k") return value << 10;
+    if (suffix == "M" || suffix == "m") return value << 20;
+    if (suffix == "G" || suffix == "g") return value << 30;
+    return 0;
+}
+
+// "IDENTIFIER=5,NUMBER=1" -> weights; false if an entry has no '='
+bool parseMix(const string& text, map<string, double>& weights) {
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t comma = text.find(',', start);
+        string entry = text.substr(start, comma == string::npos ? string::npos : comma - start);
+        size_t equals = entry.find('=');
+        if (equals == string::npos) return false;
+        weights[entry.substr(0, equals)] = atof(entry.c_str() + equals + 1);
+        if (comma == string::npos) break;
+        start = comma + 1;
+    }
+    return true;
+}
+
+// Writes the trace file on every return path once tracing has started
+struct TraceWriter {
+    string path;
+    
+    ~TraceWriter() {
+        if (!path.empty()) {
+            Trace::finish(path);
+        }
+    }
+};
+
+int runCommandLine(int argc, char* argv[]) {
+    string specFile, outputFile, manifest, target, traceFile;
+    vector<string> samples, corpus, profileCorpus, diffCorpus;
+    string profileIn, profileOut;
+    unsigned threads = 0;
+    bool threadsGiven = false;
+    bool verbose = false;
+    bool reorder = false;
+    bool verify = false;
+    bool perf = false;
+    bool diffTest = false;
+    bool predefined = false;
+    size_t randomInputs = 1000;
+    unsigned seed = 1;
+    uint64_t corpusBytes = 0;
+    string corpusOut, mix;
+    
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg == "-o" && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else if (arg == "-t" && i + 1 < argc) {
+            target = argv[++i];
+        } else if (arg == "-j" && i + 1 < argc) {
+            size_t count;
+            if (!parsePositiveOption(argv[++i], count) || count > numeric_limits<unsigned>::max()) {
+                cerr << "Invalid thread count: " << argv[i] << endl;
+                printUsage(argv[0]);
+                return 2;
+            }
+            threads = static_cast<unsigned>(count);
+            threadsGiven = true;
+        } else if (arg == "--profile" && i + 1 < argc) {
+            profileCorpus.push_back(argv[++i]);
+        } else if (arg == "--profile-in" && i + 1 < argc) {
+            profileIn = argv[++i];
+        } else if (arg == "--profile-out" && i + 1 < argc) {
+            profileOut = argv[++i];
+        } else if (arg == "--autotune" && i + 1 < argc) {
+            corpus.push_back(argv[++i]);
+        } else if (arg == "--run" && i + 1 < argc) {
+            samples.push_back(argv[++i]);
+        } else if (arg == "--batch" && i + 1 < argc) {
+            manifest = argv[++i];
+        } else if (arg == "--difftest" && i + 1 < argc) {
+            diffCorpus.push_back(argv[++i]);
+            diffTest = true;
+        } else if (arg == "--random" && i + 1 < argc) {
+            randomInputs = static_cast<size_t>(atol(argv[++i]));
+            diffTest = true;
+        } else if (arg == "--gen-corpus" && i + 1 < argc) {
+            corpusBytes = parseByteSize(argv[++i]);
+            if (corpusBytes == 0) {
+                cerr << "Invalid corpus size: " << argv[i] << endl;
+                return 2;
+            }
+        } else if (arg == "--corpus-out" && i + 1 < argc) {
+            corpusOut = argv[++i];
+        } else if (arg == "--mix" && i + 1 < argc) {
+            mix = argv[++i];
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = static_cast<unsigned>(atol(argv[++i]));
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            traceFile = argv[++i];
+        } else if (arg == "--perf") {
+            perf = true;
+        } else if (arg == "--reorder") {
+            reorder = true;
+        } else if (arg == "--predefined") {
+            predefined = true;
+        } else if (arg == "-v") {
+            verbose = true;
+        } else if (!arg.empty() && arg[0] != '-' && specFile.empty()) {
+            specFile = arg;
+        } else {
+            cerr << "Unknown or incomplete argument: " << arg << endl;
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    
+    TraceWriter traceWriter;
+    if (!traceFile.empty()) {
+        Trace::start();
+        traceWriter.path = traceFile;
+    }
+    
+    if (!manifest.empty()) {
+        vector<BatchBuilder::SpecResult> results = BatchBuilder::run(manifest, threads);
+        BatchBuilder::printReport(results);
+        for (const auto& result : results) {
+            if (!result.success) return 1;
+        }
+        return results.empty() ? 1 : 0;
+    }
+    
+    if (specFile.empty() == !predefined) {
+        printUsage(argv[0]);
+        return 2;
+    }
+    
+    LexicalAnalyzerGenerator generator;
+    generator.setVerbose(verbose);
+    generator.setPerfCounters(perf);
+    if (predefined) {
+        generator.addPredefinedPatterns();
+        specFile = "predefined";  // names the default output files
+    } else if (!generator.loadSpecFile(specFile)) {
+        return 1;
+    }
+    if (threadsGiven) {
+        generator.setThreadCount(threads);
+    }
+    if (outputFile.empty()) {
+        outputFile = generator.getOption("output", defaultOutputFile(specFile));
+    }
+    if (target.empty()) {
+        target = generator.getOption("target", corpus.empty() ? "cpp" : "capi");
+    }
+    if (target != "cpp" && target != "capi" && target != "c") {
+        cerr << "Unknown target: " << target << endl;
+        return 2;
+    }
+    if (!corpus.empty() && target != "capi") {
+        cerr << "--autotune chooses among the C API layouts and needs target capi, not " << target << endl;
+        return 2;
+    }
+    
+    auto start = chrono::steady_clock::now();
+    generator.build();
+    auto built = chrono::steady_clock::now();
+    if (generator.getDFA().getStates().empty()) {
+        return 1;
+    }
+    
+    if (reorder || generator.getOption("reorder") == "locality") {
+        double before = generator.getDFA().meanSuccessorDistance();
+        generator.reorderForLocality();
+        cout << "Reordered for locality: mean successor distance " << before << " -> "
+             << generator.getDFA().meanSuccessorDistance() << " rows" << endl;
+    }
+    
+    if (!profileCorpus.empty() || !profileIn.empty()) {
+        StateProfile profile;
+        if (!profileIn.empty() && !profile.load(profileIn)) {
+            return 1;
+        }
+        if (!profileCorpus.empty() && !generator.collectProfile(profileCorpus, profile)) {
+            return 1;
+        }
+        if (!profileOut.empty() && !profile.save(profileOut)) {
+            return 1;
+        }
+        if (!generator.applyProfile(profile)) {
+            return 1;
+        }
+        cout << "Profile: " << profile.totalVisits() << " state visits, " << generator.getHotStates().size();
+        if (target == "capi") {
+            cout << " hot state(s) direct-coded" << endl;
+        } else {
+            // The cpp and c emitters are table-only; they still get the hot-first numbering
+            cout << " hot state(s) numbered first; direct coding of hot states applies only to -t capi" << endl;
+        }
+    }
+    
+    if (corpusBytes > 0) {
+        CorpusGenerator corpusGenerator(generator.getDFA());
+        map<string, double> weights;
+        if (!mix.empty() && (!parseMix(mix, weights) || !corpusGenerator.setWeights(weights))) {
+            cerr << "Invalid --mix: " << mix << endl;
+            return 2;
+        }
+        if (corpusOut.empty()) {
+            corpusOut = withoutExtension(specFile) + ".corpus.txt";
+        }
+        ofstream out(corpusOut, ios::binary);
+        size_t tokens = out.is_open() ? corpusGenerator.generate(corpusBytes, seed, out) : 0;
+        out.close();
+        if (!out) {
+            cerr << "Error: Could not write " << corpusOut << endl;
+            return 1;
+        }
+        cout << corpusOut << ": " << tokens << " tokens, seed " << seed << endl;
+        return 0;
+    }
+    
+    string counterexample;
+    if (verify && !generator.verify(counterexample)) {
+        cerr << "Verification failed: the DFA differs from the reference on input \""
+             << printableString(counterexample) << "\"" << endl;
+        return 1;
+    } else if (verify) {
+        cout << "Verified: DFA is equivalent to the reference subset construction" << endl;
+    }
+    
+    bool written;
+    if (!corpus.empty()) {
+        written = generator.autotune(corpus, withoutExtension(outputFile));
+    } else if (target == "capi") {
+        written = generator.generateCApi(withoutExtension(outputFile));
+    } else if (target == "c") {
+        written = generator.generateC(withoutExtension(outputFile));
+    } else {
+        written = generator.generateCode(outputFile);
+    }
+    if (!written) {
+        return 1;
+    }
+    auto emitted = chrono::steady_clock::now();
+    
+    const EmitReport& report = generator.getLastEmitReport();
+    cout << outputFile << ": " << generator.getTokenOrder().size() << " rules, "
+         << generator.getDFA().getStates().size() << " DFA states (build "
+         << chrono::duration<double, milli>(built - start).count() << " ms, emit "
+         << chrono::duration<double, milli>(emitted - built).count() << " ms, "
+         << report.bytes << " bytes in " << report.files.size() << " file(s))" << endl;
+    if (verbose) {
+        printBuildStats(generator.getBuildStats());  // includes the emitted table size
+    }
+    
+    if (!samples.empty() && !generator.runGenerated(samples)) {
+        return 1;
+    }
+    if (diffTest && !generator.differentialTest(diffCorpus, randomInputs, seed)) {
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        return runCommandLine(argc, argv);
+    }
+    
     LexicalAnalyzerGenerator generator;
     int choice;
     bool built = false;
@@ -114,9 +464,10 @@ int main() {
             
             case 2: {
                 cout << "\nBuilding lexical analyzer..." << endl;
-                generator.build();
+                BuildStats stats = generator.build();
                 built = true;
                 cout << "\nLexical analyzer built successfully!" << endl;
+                printBuildStats(stats);
                 break;
             }
             
@@ -145,10 +496,11 @@ int main() {
                     string filename;
                     cout << "\nEnter output filename (e.g., lexer.cpp): ";
                     getline(cin, filename);
-                    generator.generateCode(filename);
-                    cout << "\nYou can now compile and run the generated file:" << endl;
-                    cout << "  g++ -o lexer " << filename << endl;
-                    cout << "  ./lexer" << endl;
+                    if (generator.generateCode(filename)) {
+                        cout << "\nYou can now compile and run the generated file:" << endl;
+                        cout << "  g++ -o lexer " << filename << endl;
+                        cout << "  ./lexer" << endl;
+                    }
                 }
                 break;
             }
@@ -164,6 +516,29 @@ int main() {
                 return 0;
             }
             
+            case 8: {
+                string manifest;
+                cout << "\nEnter manifest filename (one spec file per line): ";
+                getline(cin, manifest);
+                BatchBuilder::printReport(BatchBuilder::run(manifest));
+                break;
+            }
+            
+            case 9: {
+                if (!built) {
+                    cout << "\nPlease build the analyzer first (option 2)!" << endl;
+                    break;
+                }
+                vector<string> samples;
+                string sample;
+                cout << "\nEnter sample input files, one per line (empty line to finish):" << endl;
+                while (getline(cin, sample) && !sample.empty()) {
+                    samples.push_back(sample);
+                }
+                generator.runGenerated(samples);
+                break;
+            }
+            
             default: {
                 cout << "\nInvalid choice! Please try again." << endl;
                 break;
@@ -0,0 +1,13 @@
+# Run COMMAND (a ;-separated list) and fail unless it exits with EXPECTED_EXIT
+# and, when EXPECTED_OUTPUT is given, prints a line matching that regex
+execute_process(COMMAND ${COMMAND}
+                RESULT_VARIABLE result
+                OUTPUT_VARIABLE output
+                ERROR_VARIABLE output)
+message("${output}")
+if(NOT result STREQUAL "${EXPECTED_EXIT}")
+    message(FATAL_ERROR "exit status ${result}, expected ${EXPECTED_EXIT}")
+endif()
+if(DEFINED EXPECTED_OUTPUT AND NOT output MATCHES "${EXPECTED_OUTPUT}")
+    message(FATAL_ERROR "output does not match '${EXPECTED_OUTPUT}'")
+endif()